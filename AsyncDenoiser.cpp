@@ -0,0 +1,253 @@
+//============================================================================
+// Name        : AsyncDenoiser.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : asynchronous denoising on a shared, bounded thread pool
+//============================================================================
+
+#include "AsyncDenoiser.h"
+#include "RegionFilter.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+
+namespace dip2
+{
+
+    namespace
+    {
+        // strips of fewer rows would spend a large part of their work on the halo of the filter
+        const int minStripRows = 64;
+
+        // an image split into strips, the strip finishing last hands the result on
+        struct StripJob
+        {
+            cv::Mat_<float> src;
+            NoiseType noiseType;
+            NoiseReductionAlgorithm noiseReductionAlgorithm;
+            AsyncDenoiser::Callback done;
+
+            std::once_flag allocated;
+            cv::Mat_<float> dst;
+            std::atomic<int> remaining;
+            std::mutex errorMutex;
+            std::exception_ptr error;
+        };
+
+        void runStrip(StripJob &job, const cv::Rect &strip)
+        {
+            try
+            {
+                // this pool provides the parallelism, the filter must not use OpenCV's pool as well
+                SerialFilterScope serial;
+                const FilterParameters params = denoiseParameters(job.noiseType, job.noiseReductionAlgorithm);
+                std::call_once(job.allocated, [&job]() { job.dst.create(job.src.size()); });
+                filterRegion(job.src, job.dst, strip, job.noiseReductionAlgorithm, params.kSize, params.sigma_spatial, params.sigma_radiometric);
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(job.errorMutex);
+                if (!job.error)
+                    job.error = std::current_exception();
+            }
+
+            if (--job.remaining == 0)
+            {
+                // an exception escaping the worker thread would terminate the process
+                try
+                {
+                    job.done(job.error ? cv::Mat_<float>() : job.dst, job.error);
+                }
+                catch (const std::exception &e)
+                {
+                    std::cerr << "AsyncDenoiser: callback threw an exception: " << e.what() << std::endl;
+                }
+                catch (...)
+                {
+                    std::cerr << "AsyncDenoiser: callback threw an exception" << std::endl;
+                }
+            }
+        }
+
+        // delivers the result of a job through a future
+        AsyncDenoiser::Callback fulfil(const std::shared_ptr<std::promise<cv::Mat_<float>>> &promise)
+        {
+            return [promise](const cv::Mat_<float> &result, std::exception_ptr error)
+            {
+                if (error)
+                    promise->set_exception(error);
+                else
+                    promise->set_value(result);
+            };
+        }
+    }
+
+    AsyncDenoiser::AsyncDenoiser(int numThreads, std::size_t maxQueuedJobs, std::size_t maxQueuedPixels)
+        : m_maxQueuedJobs(maxQueuedJobs), m_maxQueuedPixels(maxQueuedPixels), m_queuedJobs(0), m_queuedPixels(0), m_nextSequence(0), m_running(0), m_stopping(false)
+    {
+        if (maxQueuedJobs < 1)
+        {
+            throw std::runtime_error("Queue must hold at least one job");
+        }
+        if (numThreads <= 0)
+        {
+            numThreads = std::max(1u, std::thread::hardware_concurrency());
+        }
+        for (int i = 0; i < numThreads; i++)
+        {
+            m_workers.push_back(std::thread(&AsyncDenoiser::workerLoop, this));
+        }
+    }
+
+    AsyncDenoiser::~AsyncDenoiser()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stopping = true;
+        }
+        m_workAvailable.notify_all();
+        m_spaceAvailable.notify_all();
+        for (size_t i = 0; i < m_workers.size(); i++)
+        {
+            m_workers[i].join();
+        }
+    }
+
+    std::future<cv::Mat_<float>> AsyncDenoiser::submit(const cv::Mat_<float> &src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority)
+    {
+        std::shared_ptr<std::promise<cv::Mat_<float>>> promise = std::make_shared<std::promise<cv::Mat_<float>>>();
+        std::future<cv::Mat_<float>> result = promise->get_future();
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_spaceAvailable.wait(lock, [&]() { return m_stopping || fits(src.total()); });
+        enqueue(lock, src, noiseType, noiseReductionAlgorithm, priority, fulfil(promise));
+        return result;
+    }
+
+    void AsyncDenoiser::submit(const cv::Mat_<float> &src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority, Callback callback)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_spaceAvailable.wait(lock, [&]() { return m_stopping || fits(src.total()); });
+        enqueue(lock, src, noiseType, noiseReductionAlgorithm, priority, callback);
+    }
+
+    bool AsyncDenoiser::trySubmit(const cv::Mat_<float> &src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority, std::future<cv::Mat_<float>> &result)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_stopping || !fits(src.total()))
+        {
+            return false;
+        }
+
+        std::shared_ptr<std::promise<cv::Mat_<float>>> promise = std::make_shared<std::promise<cv::Mat_<float>>>();
+        result = promise->get_future();
+        enqueue(lock, src, noiseType, noiseReductionAlgorithm, priority, fulfil(promise));
+        return true;
+    }
+
+    void AsyncDenoiser::waitIdle()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_idle.wait(lock, [&]() { return m_queue.empty() && m_running == 0; });
+    }
+
+    std::size_t AsyncDenoiser::queuedJobs() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queuedJobs;
+    }
+
+    std::size_t AsyncDenoiser::queuedPixels() const
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_queuedPixels;
+    }
+
+    // expects m_mutex to be locked
+    bool AsyncDenoiser::fits(std::size_t pixels) const
+    {
+        if (m_queuedJobs >= m_maxQueuedJobs)
+            return false;
+        // an empty queue takes any image, otherwise huge images could never be submitted
+        return m_queue.empty() || m_queuedPixels + pixels <= m_maxQueuedPixels;
+    }
+
+    // expects lock to hold m_mutex and the job to fit into the queue
+    void AsyncDenoiser::enqueue(std::unique_lock<std::mutex> &lock, const cv::Mat_<float> &src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm,
+                                int priority, Callback done)
+    {
+        if (m_stopping)
+        {
+            throw std::runtime_error("AsyncDenoiser is shutting down");
+        }
+
+        std::shared_ptr<StripJob> stripJob = std::make_shared<StripJob>();
+        stripJob->src = src;
+        stripJob->noiseType = noiseType;
+        stripJob->noiseReductionAlgorithm = noiseReductionAlgorithm;
+        stripJob->done = done;
+
+        // the strips get consecutive sequence numbers, so they are started one after another
+        const int strips = std::max(1, std::min(numThreads(), src.rows / minStripRows));
+        stripJob->remaining = strips;
+        for (int i = 0; i < strips; i++)
+        {
+            const int top = src.rows * i / strips;
+            const cv::Rect strip(0, top, src.cols, src.rows * (i + 1) / strips - top);
+
+            Job job;
+            job.priority = priority;
+            job.sequence = m_nextSequence++;
+            job.pixels = strip.area();
+            job.first = i == 0;
+            job.run = [stripJob, strip]() { runStrip(*stripJob, strip); };
+            m_queue.push(job);
+            m_queuedPixels += job.pixels;
+        }
+        m_queuedJobs++;
+
+        lock.unlock();
+        if (strips == 1)
+            m_workAvailable.notify_one();
+        else
+            m_workAvailable.notify_all();
+    }
+
+    void AsyncDenoiser::workerLoop()
+    {
+        for (;;)
+        {
+            Job job;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_workAvailable.wait(lock, [&]() { return m_stopping || !m_queue.empty(); });
+                // queued jobs are finished before shutting down
+                if (m_queue.empty())
+                    return;
+
+                job = m_queue.top();
+                m_queue.pop();
+                m_queuedPixels -= job.pixels;
+                if (job.first)
+                    m_queuedJobs--;
+                m_running++;
+            }
+            m_spaceAvailable.notify_all();
+
+            // exceptions are delivered through the future resp. the callback of the job
+            job.run();
+
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_running--;
+                if (m_queue.empty() && m_running == 0)
+                    m_idle.notify_all();
+            }
+        }
+    }
+
+}
@@ -0,0 +1,139 @@
+//============================================================================
+// Name        : AsyncDenoiser.h
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : asynchronous denoising on a shared, bounded thread pool
+//============================================================================
+
+#ifndef ASYNCDENOISER_H
+#define ASYNCDENOISER_H
+
+#include "Dip2.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace dip2 {
+
+/**
+ * @brief Runs denoiseImage(...) asynchronously on a pool of worker threads
+ * @details Jobs are picked by priority (higher first) and in submission order within the same priority.
+ *          The queue of waiting jobs is bounded both in number of jobs and in number of pixels, submit(...)
+ *          blocks while it is full (backpressure), trySubmit(...) fails instead. A single image larger than
+ *          the pixel budget is still accepted once the queue is empty.
+ *          The image data is not copied: don't modify a submitted image until its result is available.
+ *
+ *          Threads: the filters are parallel over their tiles themselves (cv::parallel_for_). Called from
+ *          several workers at once they would compete for OpenCV's thread pool: OpenCV runs concurrent
+ *          parallel loops one after another resp. sequentially on the caller (pthreads backend) or starts
+ *          a full set of threads for each of them (OpenMP, TBB), up to numThreads x cv::getNumThreads().
+ *          The workers therefore run the filters inside a SerialFilterScope and this pool is the only one
+ *          doing the work. To still use all workers for a single large image, images are split into up
+ *          to numThreads row strips which are queued as separate tasks and filtered with filterRegion(...);
+ *          the result is identical to denoiseImage(...).
+ */
+class AsyncDenoiser
+{
+    public:
+        typedef std::function<void(const cv::Mat_<float>& result, std::exception_ptr error)> Callback;
+
+        /**
+         * @param numThreads Number of worker threads (0: one per CPU)
+         * @param maxQueuedJobs Maximal number of jobs waiting for a worker
+         * @param maxQueuedPixels Maximal number of pixels of all images waiting for a worker
+         */
+        AsyncDenoiser(int numThreads, std::size_t maxQueuedJobs, std::size_t maxQueuedPixels);
+
+        /// Finishes all queued jobs, then stops the workers
+        ~AsyncDenoiser();
+
+        /**
+         * @brief Queues an image for denoising, blocks while the queue is full
+         * @param src Input image
+         * @param noiseType Noise type passed on to denoiseImage(...)
+         * @param noiseReductionAlgorithm Filter passed on to denoiseImage(...)
+         * @param priority Jobs with higher priority are processed first
+         * @returns Future of the denoised image, rethrows exceptions of denoiseImage(...)
+         */
+        std::future<cv::Mat_<float>> submit(const cv::Mat_<float>& src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority);
+
+        /**
+         * @brief Queues an image for denoising, blocks while the queue is full
+         * @details callback is called from the worker thread, with either the result or the exception of denoiseImage(...).
+         *          The callback must not throw: exceptions thrown by it are caught, reported on std::cerr and otherwise dropped.
+         */
+        void submit(const cv::Mat_<float>& src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority, Callback callback);
+
+        /**
+         * @brief Like submit(...), but fails instead of blocking if the queue is full
+         * @param result Future of the denoised image, only valid if the job was queued
+         * @returns true if the job was queued
+         */
+        bool trySubmit(const cv::Mat_<float>& src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm, int priority, std::future<cv::Mat_<float>>& result);
+
+        /// Blocks until all submitted jobs are done
+        void waitIdle();
+
+        /// Number of jobs waiting for a worker (jobs of which no strip has been started yet)
+        std::size_t queuedJobs() const;
+
+        /// Number of pixels of all images waiting for a worker
+        std::size_t queuedPixels() const;
+
+        int numThreads() const { return (int)m_workers.size(); }
+
+    private:
+        // one row strip of a submitted image
+        struct Job
+        {
+            int priority;
+            std::uint64_t sequence;
+            std::size_t pixels;
+            bool first;                 // first strip of its image, starting it removes the image from the queued jobs
+            std::function<void()> run;
+        };
+
+        // std::priority_queue puts the largest element on top: higher priority, then lower sequence number
+        struct JobOrder
+        {
+            bool operator()(const Job& a, const Job& b) const
+            {
+                return a.priority < b.priority || (a.priority == b.priority && a.sequence > b.sequence);
+            }
+        };
+
+        std::size_t m_maxQueuedJobs;
+        std::size_t m_maxQueuedPixels;
+
+        mutable std::mutex m_mutex;
+        std::condition_variable m_workAvailable;
+        std::condition_variable m_spaceAvailable;
+        std::condition_variable m_idle;
+        std::priority_queue<Job, std::vector<Job>, JobOrder> m_queue;
+        std::size_t m_queuedJobs;
+        std::size_t m_queuedPixels;
+        std::uint64_t m_nextSequence;
+        int m_running;
+        bool m_stopping;
+
+        std::vector<std::thread> m_workers;
+
+        bool fits(std::size_t pixels) const;
+        void enqueue(std::unique_lock<std::mutex>& lock, const cv::Mat_<float>& src, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm,
+                     int priority, Callback done);
+        void workerLoop();
+};
+
+}
+
+#endif // ASYNCDENOISER_H
@@ -8,126 +8,809 @@
 
 #include "Dip2.h"
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+// F16C conversions are compiled for x86 regardless of the target flags and selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIP2_F16C_DISPATCH
+#include <immintrin.h>
+#endif
+
 using namespace std;
 using namespace cv;
 
 namespace dip2
 {
 
-    /**
-     * @brief Convolution in spatial domain.
-     * @details Performs spatial convolution of image and filter kernel.
-     * @params src Input image
-     * @params kernel Filter kernel
-     * @returns Convolution result
-     */
-    cv::Mat_<float> spatialConvolution(const cv::Mat_<float> &src, const cv::Mat_<float> &kernel)
+    namespace
     {
-        cv::Mat result = src.clone();
-        int borderSize = 0;
-        // pls only use odd kernels and kernals > 1x1
-        if (kernel.rows <= 1 && kernel.cols <= 1)
+        size_t detectCacheSizeL2()
         {
-            throw std::runtime_error("Kernel size must be greater than 1 and of odd size");
+#if defined(_SC_LEVEL2_CACHE_SIZE)
+            long size = sysconf(_SC_LEVEL2_CACHE_SIZE);
+            if (size > 0)
+                return (size_t)size;
+#endif
+            // e.g. "1024K"
+            std::ifstream file("/sys/devices/system/cpu/cpu0/cache/index2/size");
+            size_t size_kb = 0;
+            if (file >> size_kb && size_kb > 0)
+                return size_kb * 1024;
+            return 256 * 1024;
         }
-        else
+
+        // set while a SerialFilterScope is alive on this thread
+        thread_local bool serialFilters = false;
+
+        // cv::parallel_for_, unless the filters have to stay on the calling thread
+        template <class Body>
+        void parallelFor(const cv::Range &range, const Body &body)
         {
-            int borderSize = (kernel.rows - 1) / 2;
-            // Add the border to the result image
-            cv::copyMakeBorder(result, result, borderSize, borderSize, borderSize, borderSize, cv::BORDER_REPLICATE);
-            std::cout << result.rows << " " << result.cols << std::endl;
-            std::cout << src.rows << " " << src.cols << std::endl;
+            if (serialFilters)
+                body(range);
+            else
+                cv::parallel_for_(range, body);
+        }
+
+        // calls body(tile) for every tile of an image, the tiles are distributed over the worker threads
+        template <class Body>
+        void forEachTile(cv::Size imageSize, cv::Size tileSize, const Body &body)
+        {
+            const int tilesX = (imageSize.width + tileSize.width - 1) / tileSize.width;
+            const int tilesY = (imageSize.height + tileSize.height - 1) / tileSize.height;
+            parallelFor(cv::Range(0, tilesX * tilesY), [&](const cv::Range &range)
+            {
+                for (int t = range.start; t < range.end; t++)
+                {
+                    const int x = (t % tilesX) * tileSize.width;
+                    const int y = (t / tilesX) * tileSize.height;
+                    body(cv::Rect(x, y, std::min(tileSize.width, imageSize.width - x), std::min(tileSize.height, imageSize.height - y)));
+                }
+            });
         }
 
-        // rotate the kernel by 180 degrees
-        cv::flip(kernel, kernel, -1);
-        // std::cout << kernel << std::endl;
+        // half precision (IEEE binary16) to float
+        inline float float16ToFloat(ushort h)
+        {
+            const std::uint32_t sign = (std::uint32_t)(h & 0x8000) << 16;
+            const std::uint32_t exponent = (h >> 10) & 0x1f;
+            const std::uint32_t mantissa = h & 0x3ff;
+            std::uint32_t bits;
+            if (exponent == 0)
+            {
+                // zero or subnormal: mantissa * 2^-24
+                float value = (float)mantissa * 5.9604645e-8f;
+                std::memcpy(&bits, &value, sizeof(bits));
+            }
+            else if (exponent == 31)
+                bits = 0x7f800000 | (mantissa << 13);
+            else
+                bits = ((exponent + 112) << 23) | (mantissa << 13);
+            bits |= sign;
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
 
-        // Perform the convolution operation
-        for (int i = borderSize; i < src.rows + borderSize; i++)
+        // float to half precision, rounding to nearest even
+        inline ushort floatToFloat16(float value)
         {
-            for (int j = borderSize; j < src.cols + borderSize; j++)
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            const std::uint32_t sign = bits & 0x80000000u;
+            bits ^= sign;
+
+            std::uint32_t half;
+            if (bits >= (127u + 16u) << 23)
+                // overflow to infinity, or NaN
+                half = bits > 0x7f800000u ? 0x7e00 : 0x7c00;
+            else if (bits < 113u << 23)
             {
-                float averagePixelValue = 0;
-                for (int k = 0; k < kernel.rows; k++)
+                // subnormal or zero: adding 0.5 aligns the mantissa such that the FPU does the rounding
+                float shifted;
+                std::memcpy(&shifted, &bits, sizeof(shifted));
+                shifted += 0.5f;
+                std::memcpy(&half, &shifted, sizeof(half));
+                half -= 0x3f000000u;
+            }
+            else
+            {
+                const std::uint32_t mantissaOdd = (bits >> 13) & 1;
+                bits += 0xc8000fffu + mantissaOdd; // rebias the exponent and round
+                half = bits >> 13;
+            }
+            return (ushort)(half | (sign >> 16));
+        }
+
+        inline float bfloat16ToFloat(ushort b)
+        {
+            const std::uint32_t bits = (std::uint32_t)b << 16;
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // float to bfloat16 (upper half of a float), rounding to nearest even
+        inline ushort floatToBfloat16(float value)
+        {
+            std::uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            if ((bits & 0x7fffffffu) > 0x7f800000u)
+                return (ushort)((bits >> 16) | 0x40); // keep NaN a (quiet) NaN
+            bits += 0x7fff + ((bits >> 16) & 1);
+            return (ushort)(bits >> 16);
+        }
+
+#ifdef DIP2_F16C_DISPATCH
+        // 8 conversions per instruction, only called if the CPU supports F16C (see hasF16C())
+        __attribute__((target("avx,f16c")))
+        void decodeFloat16F16C(const ushort *in, int count, float *out)
+        {
+            int i = 0;
+            for (; i + 8 <= count; i += 8)
+                _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(in + i))));
+            for (; i < count; i++)
+                out[i] = float16ToFloat(in[i]);
+        }
+
+        __attribute__((target("avx,f16c")))
+        void encodeFloat16F16C(const float *in, int count, ushort *out)
+        {
+            int i = 0;
+            for (; i + 8 <= count; i += 8)
+                _mm_storeu_si128((__m128i *)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+            for (; i < count; i++)
+                out[i] = floatToFloat16(in[i]);
+        }
+
+        bool hasF16C()
+        {
+            static const bool available = __builtin_cpu_supports("avx") && __builtin_cpu_supports("f16c");
+            return available;
+        }
+#endif
+
+        void decodeRow(const ushort *in, int count, StoragePrecision storage, float *out)
+        {
+            if (storage == STORAGE_BFLOAT16)
+            {
+                for (int i = 0; i < count; i++)
+                    out[i] = bfloat16ToFloat(in[i]);
+                return;
+            }
+#ifdef DIP2_F16C_DISPATCH
+            if (hasF16C())
+            {
+                decodeFloat16F16C(in, count, out);
+                return;
+            }
+#endif
+            for (int i = 0; i < count; i++)
+                out[i] = float16ToFloat(in[i]);
+        }
+
+        void encodeRow(const float *in, int count, StoragePrecision storage, ushort *out)
+        {
+            if (storage == STORAGE_BFLOAT16)
+            {
+                for (int i = 0; i < count; i++)
+                    out[i] = floatToBfloat16(in[i]);
+                return;
+            }
+#ifdef DIP2_F16C_DISPATCH
+            if (hasF16C())
+            {
+                encodeFloat16F16C(in, count, out);
+                return;
+            }
+#endif
+            for (int i = 0; i < count; i++)
+                out[i] = floatToFloat16(in[i]);
+        }
+
+        // Scratch image stored either as float or, for the 16 bit storage precisions, as raw 16 bit
+        // values. The filters read it tile by tile as float and always compute in float.
+        struct StoredImage
+        {
+            StoragePrecision storage;
+            cv::Mat_<float> &data32;
+            cv::Mat_<ushort> &data16;
+
+            int rows() const { return storage == STORAGE_FLOAT32 ? data32.rows : data16.rows; }
+
+            void create(int rows, int cols)
+            {
+                if (storage == STORAGE_FLOAT32)
+                    data32.create(rows, cols);
+                else
+                    data16.create(rows, cols);
+            }
+
+            // float view of region: the buffer itself for float storage, otherwise decoded into scratch
+            cv::Mat_<float> load(const cv::Rect &region, cv::Mat_<float> &scratch) const
+            {
+                if (storage == STORAGE_FLOAT32)
+                    return data32(region);
+                scratch.create(region.height, region.width);
+                for (int i = 0; i < region.height; i++)
+                    decodeRow(data16[region.y + i] + region.x, region.width, storage, scratch[i]);
+                return scratch;
+            }
+
+            void storeRow(int y, int x, const float *values, int count)
+            {
+                if (storage == STORAGE_FLOAT32)
+                    std::copy(values, values + count, data32[y] + x);
+                else
+                    encodeRow(values, count, storage, data16[y] + x);
+            }
+        };
+
+        // whole image kept in one of the storage precisions, e.g. a pyramid level
+        struct StoredLevel
+        {
+            cv::Mat_<float> data32;
+            cv::Mat_<ushort> data16;
+        };
+
+        void storeLevel(const cv::Mat_<float> &img, StoragePrecision storage, StoredLevel &level)
+        {
+            if (storage == STORAGE_FLOAT32)
+            {
+                // no conversion, share the buffer
+                level.data32 = img;
+                return;
+            }
+            StoredImage stored = {storage, level.data32, level.data16};
+            stored.create(img.rows, img.cols);
+            for (int y = 0; y < img.rows; y++)
+                stored.storeRow(y, 0, img[y], img.cols);
+        }
+
+        cv::Mat_<float> loadLevel(StoredLevel &level, StoragePrecision storage)
+        {
+            if (storage == STORAGE_FLOAT32)
+                return level.data32;
+            StoredImage stored = {storage, level.data32, level.data16};
+            cv::Mat_<float> img;
+            stored.load(cv::Rect(0, 0, level.data16.cols, level.data16.rows), img);
+            return img;
+        }
+
+        // copies src with a replicated border of the given size into padded
+        void storePadded(const cv::Mat_<float> &src, int borderY, int borderX, StoredImage &padded)
+        {
+            if (padded.storage == STORAGE_FLOAT32)
+            {
+                cv::copyMakeBorder(src, padded.data32, borderY, borderY, borderX, borderX, cv::BORDER_REPLICATE);
+                return;
+            }
+
+            const int cols = src.cols + 2 * borderX;
+            padded.create(src.rows + 2 * borderY, cols);
+            parallelFor(cv::Range(0, src.rows), [&](const cv::Range &range)
+            {
+                std::vector<float> row(cols);
+                for (int y = range.start; y < range.end; y++)
+                {
+                    const float *in = src[y];
+                    std::fill(row.begin(), row.begin() + borderX, in[0]);
+                    std::copy(in, in + src.cols, row.begin() + borderX);
+                    std::fill(row.begin() + borderX + src.cols, row.end(), in[src.cols - 1]);
+                    padded.storeRow(y + borderY, 0, &row[0], cols);
+                }
+            });
+            // the border rows are copies of the first resp. last (already converted) row
+            for (int y = 0; y < borderY; y++)
+            {
+                std::copy(padded.data16[borderY], padded.data16[borderY] + cols, padded.data16[y]);
+                std::copy(padded.data16[borderY + src.rows - 1], padded.data16[borderY + src.rows - 1] + cols, padded.data16[borderY + src.rows + y]);
+            }
+        }
+
+        // region of the padded source read by the filter window for the pixels of tile
+        inline cv::Rect haloRegion(const cv::Rect &tile, cv::Size window)
+        {
+            return cv::Rect(tile.x, tile.y, tile.width + window.width - 1, tile.height + window.height - 1);
+        }
+
+        // The filter implementations below all read from a copy of the source padded by the filter
+        // halo and write into a preallocated output of the source size. Each tile first fetches its
+        // part of the padded copy as float (in), whose origin is the top left corner of the tile's halo.
+
+        // direct 2D convolution with an already flipped kernel.
+        // Within a tile every output row is accumulated as whole: for each kernel tap the
+        // corresponding input row segment is scaled and added, which keeps the inner loop
+        // contiguous and lets the compiler vectorize it.
+        void convolveDirect(const StoredImage &padded, const cv::Mat_<float> &kernel, cv::Size tileSize, cv::Mat_<float> &dst)
+        {
+            forEachTile(dst.size(), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = padded.load(haloRegion(tile, kernel.size()), scratch);
+                std::vector<float> rowSum(tile.width);
+                for (int i = 0; i < tile.height; i++)
+                {
+                    std::fill(rowSum.begin(), rowSum.end(), 0.0f);
+                    for (int k = 0; k < kernel.rows; k++)
+                    {
+                        const float *row = in[i + k];
+                        for (int l = 0; l < kernel.cols; l++)
+                        {
+                            const float weight = kernel(k, l);
+                            const float *tap = row + l;
+                            for (int j = 0; j < tile.width; j++)
+                            {
+                                rowSum[j] += weight * tap[j];
+                            }
+                        }
+                    }
+                    std::copy(rowSum.begin(), rowSum.end(), dst[tile.y + i] + tile.x);
+                }
+            });
+        }
+
+        // convolution with a separable (already flipped) kernel = colKernel * rowKernel^T,
+        // a row pass into intermediate followed by a column pass into dst
+        void convolveSeparable(const StoredImage &padded, const std::vector<float> &rowKernel, const std::vector<float> &colKernel,
+                               cv::Size tileSize, StoredImage &intermediate, cv::Mat_<float> &dst)
+        {
+            const int kRows = (int)colKernel.size();
+            const int kCols = (int)rowKernel.size();
+
+            intermediate.create(padded.rows(), dst.cols);
+            forEachTile(cv::Size(dst.cols, padded.rows()), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = padded.load(cv::Rect(tile.x, tile.y, tile.width + kCols - 1, tile.height), scratch);
+                std::vector<float> rowBuffer(tile.width);
+                for (int i = 0; i < tile.height; i++)
+                {
+                    // float storage is written directly, otherwise the row gets converted when stored
+                    float *out = intermediate.storage == STORAGE_FLOAT32 ? intermediate.data32[tile.y + i] + tile.x : &rowBuffer[0];
+                    std::fill(out, out + tile.width, 0.0f);
+                    for (int l = 0; l < kCols; l++)
+                    {
+                        const float weight = rowKernel[l];
+                        const float *tap = in[i] + l;
+                        for (int j = 0; j < tile.width; j++)
+                        {
+                            out[j] += weight * tap[j];
+                        }
+                    }
+                    if (intermediate.storage != STORAGE_FLOAT32)
+                        intermediate.storeRow(tile.y + i, tile.x, out, tile.width);
+                }
+            });
+            forEachTile(dst.size(), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = intermediate.load(cv::Rect(tile.x, tile.y, tile.width, tile.height + kRows - 1), scratch);
+                for (int i = 0; i < tile.height; i++)
+                {
+                    float *out = dst[tile.y + i] + tile.x;
+                    std::fill(out, out + tile.width, 0.0f);
+                    for (int k = 0; k < kRows; k++)
+                    {
+                        const float weight = colKernel[k];
+                        const float *tap = in[i + k];
+                        for (int j = 0; j < tile.width; j++)
+                        {
+                            out[j] += weight * tap[j];
+                        }
+                    }
+                }
+            });
+        }
+
+        void medianDirect(const StoredImage &padded, int kSize, cv::Size tileSize, cv::Mat_<float> &dst)
+        {
+            forEachTile(dst.size(), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = padded.load(haloRegion(tile, cv::Size(kSize, kSize)), scratch);
+                vector<float> values(kSize*kSize);
+
+                for (int xp = 0; xp < tile.height; xp++)
                 {
-                    for (int l = 0; l < kernel.cols; l++)
+                    for (int yp = 0; yp < tile.width; yp++)
                     {
-                        averagePixelValue += kernel.at<float>(k, l) * src.at<float>(i + k - borderSize, j + l - borderSize);
+                        // gather the window row by row
+                        for (int xk = 0; xk <= kSize-1; xk++)
+                        {
+                            const float *window = in[xp+xk] + yp;
+                            std::copy(window, window + kSize, values.begin() + xk*kSize);
+                        }
+                        std::sort(values.begin(), values.end());
+                        dst(tile.y+xp, tile.x+yp) = values[(((kSize*kSize)-1)/2)];
                     }
                 }
-                float &pixel = result.at<float>(i, j);
-                // set the pixel at i,j to the average pixel value of the kernel
-                pixel = averagePixelValue;
+            });
+        }
+
+        // replaces oldValue by newValue in the sorted array values[0..count) and keeps it sorted:
+        // the values between the old and the new position move by one slot
+        inline void replaceSorted(float *values, int count, float oldValue, float newValue)
+        {
+            float *oldPos = std::lower_bound(values, values + count, oldValue);
+            if (newValue > oldValue)
+            {
+                float *newPos = std::lower_bound(oldPos + 1, values + count, newValue);
+                std::memmove(oldPos, oldPos + 1, (newPos - oldPos - 1) * sizeof(float));
+                *(newPos - 1) = newValue;
+            }
+            else
+            {
+                float *newPos = std::upper_bound(values, oldPos, newValue);
+                std::memmove(newPos + 1, newPos, (oldPos - newPos) * sizeof(float));
+                *newPos = newValue;
             }
         }
 
-        // Remove the border from the result image
-        result = result(cv::Rect(borderSize, borderSize, src.cols, src.rows));
-        std::cout << result.rows << " " << result.cols << std::endl;
-        return result;
+        // exact median with the window kept as a sorted array: moving one pixel to the right
+        // replaces the kSize values of the leaving column by those of the entering one, each a
+        // binary search and a memmove of at most kSize*kSize floats instead of sorting all values again
+        void medianSliding(const StoredImage &padded, int kSize, cv::Size tileSize, cv::Mat_<float> &dst)
+        {
+            const int n = kSize * kSize;
+            forEachTile(dst.size(), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = padded.load(haloRegion(tile, cv::Size(kSize, kSize)), scratch);
+                std::vector<float> window(n);
+                for (int i = 0; i < tile.height; i++)
+                {
+                    for (int k = 0; k < kSize; k++)
+                    {
+                        const float *row = in[i + k];
+                        std::copy(row, row + kSize, window.begin() + k * kSize);
+                    }
+                    std::sort(window.begin(), window.end());
+                    dst(tile.y + i, tile.x) = window[n / 2];
+
+                    for (int j = 1; j < tile.width; j++)
+                    {
+                        // column j-1 leaves the window, column j+kSize-1 enters it
+                        for (int k = 0; k < kSize; k++)
+                        {
+                            const float entering = in(i + k, j + kSize - 1);
+                            const float leaving = in(i + k, j - 1);
+                            if (entering != leaving)
+                                replaceSorted(window.data(), n, leaving, entering);
+                        }
+                        dst(tile.y + i, tile.x + j) = window[n / 2];
+                    }
+                }
+            });
+        }
+
+        // bilateral filter with precomputed spatial weights and a lookup table for the radiometric weights,
+        // radiometric[(int)(|difference| * lutScale + 0.5)]
+        void bilateralDirect(const StoredImage &padded, const cv::Mat_<float> &spatial, const std::vector<float> &radiometric, float lutScale,
+                             cv::Size tileSize, cv::Mat_<float> &dst)
+        {
+            const int kSize = spatial.rows;
+            const int border = (kSize - 1) / 2;
+            const float lutEnd = (float)radiometric.size() - 1.0f;
+
+            forEachTile(dst.size(), tileSize, [&](const cv::Rect &tile)
+            {
+                cv::Mat_<float> scratch;
+                const cv::Mat_<float> in = padded.load(haloRegion(tile, spatial.size()), scratch);
+                for (int i = 0; i < tile.height; i++)
+                {
+                    for (int j = 0; j < tile.width; j++)
+                    {
+                        const float centre = in(i + border, j + border);
+                        float weightedSum = 0.0f;
+                        float weightSum = 0.0f;
+                        for (int k = 0; k < kSize; k++)
+                        {
+                            const float *row = in[i + k] + j;
+                            const float *spatialRow = spatial[k];
+                            for (int l = 0; l < kSize; l++)
+                            {
+                                const float index = std::abs(row[l] - centre) * lutScale;
+                                const float weight = index < lutEnd ? spatialRow[l] * radiometric[(int)(index + 0.5f)] : 0.0f;
+                                weightedSum += weight * row[l];
+                                weightSum += weight;
+                            }
+                        }
+                        // the centre pixel always has a non-zero weight
+                        dst(tile.y + i, tile.x + j) = weightedSum / weightSum;
+                    }
+                }
+            });
+        }
+
+        // splits kernel into colKernel * rowKernel^T if it has rank 1
+        bool separateKernel(const cv::Mat_<float> &kernel, std::vector<float> &rowKernel, std::vector<float> &colKernel)
+        {
+            int pivotRow = 0;
+            int pivotCol = 0;
+            for (int k = 0; k < kernel.rows; k++)
+                for (int l = 0; l < kernel.cols; l++)
+                    if (std::abs(kernel(k, l)) > std::abs(kernel(pivotRow, pivotCol)))
+                    {
+                        pivotRow = k;
+                        pivotCol = l;
+                    }
+            const float pivot = kernel(pivotRow, pivotCol);
+            if (pivot == 0.0f)
+                return false;
+
+            colKernel.resize(kernel.rows);
+            rowKernel.resize(kernel.cols);
+            for (int k = 0; k < kernel.rows; k++)
+                colKernel[k] = kernel(k, pivotCol);
+            for (int l = 0; l < kernel.cols; l++)
+                rowKernel[l] = kernel(pivotRow, l) / pivot;
+
+            // Move the scale into the column factor so that the row factor has unit absolute sum: the row
+            // pass then stays within the value range of the image, which keeps the rounding error of a
+            // 16 bit intermediate buffer at that of the input (instead of kernel width times larger).
+            float rowScale = 0.0f;
+            for (int l = 0; l < kernel.cols; l++)
+                rowScale += std::abs(rowKernel[l]);
+            for (int l = 0; l < kernel.cols; l++)
+                rowKernel[l] /= rowScale;
+            for (int k = 0; k < kernel.rows; k++)
+                colKernel[k] *= rowScale;
+
+            for (int k = 0; k < kernel.rows; k++)
+                for (int l = 0; l < kernel.cols; l++)
+                    if (std::abs(kernel(k, l) - colKernel[k] * rowKernel[l]) > 1e-6f * std::abs(pivot))
+                        return false;
+            return true;
+        }
     }
 
     /**
-     * @brief Moving average filter (aka box filter)
-     * @note: you might want to use Dip2::spatialConvolution(...) within this function
-     * @param src Input image
-     * @param kSize Window size used by local average
-     * @returns Filtered image
+     * @brief Size of the L2 cache in bytes
+     * @details Detected once at first use, falls back to 256 KiB if the system doesn't tell.
      */
-    cv::Mat_<float> averageFilter(const cv::Mat_<float> &src, int kSize)
+    size_t cacheSizeL2()
     {
-        cv::Mat kernel = cv::Mat::ones(kSize, kSize, CV_32FC1) / (float)(kSize * kSize); // Create a kernel with all elements equal to 1/(kSize*kSize)
-        // std::cout << kernel << std::endl;
-        return spatialConvolution(src, kernel);
+        static const size_t size = detectCacheSizeL2();
+        return size;
     }
 
     /**
-     * @brief Median filter
-     * @param src Input image
-     * @param kSize Window size used by median operation
-     * @returns Filtered image
+     * @brief Tile size used by the tiled filters
+     * @details Chosen such that a tile of float pixels plus the halo of the filter window fits into half of the L2 cache.
+     * @param kernelRows Height of the filter window
+     * @param kernelCols Width of the filter window
+     * @returns Tile size (without halo)
      */
-    cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize)
+    cv::Size filterTileSize(int kernelRows, int kernelCols)
     {
+        const int side = (int)std::sqrt((double)cacheSizeL2() / 2 / sizeof(float));
+        // keep rows a multiple of 16 floats (one cache line = 16 floats) for the inner loops
+        const int cols = std::max(16, (side - (kernelCols - 1)) & ~15);
+        const int rows = std::max(16, side - (kernelRows - 1));
+        return cv::Size(cols, rows);
+    }
 
-        int km = kSize+1/2; // kernel middle
-        int border = km-1;
+    SerialFilterScope::SerialFilterScope()
+        : m_previous(serialFilters)
+    {
+        serialFilters = true;
+    }
 
-        Mat src_gray = src;
+    SerialFilterScope::~SerialFilterScope()
+    {
+        serialFilters = m_previous;
+    }
 
-        Mat src_wb(src.rows + border*2, src.cols + border*2, src.depth());
+    FilterPlan::FilterPlan(const cv::Mat_<float> &kernel, cv::Size imageSize)
+        : m_imageSize(imageSize), m_storage(STORAGE_FLOAT32), m_separable(false), m_lutScale(0.0f)
+    {
+        initConvolution(kernel);
+    }
 
-        copyMakeBorder(src_gray, src_wb, border, border, border, border, BORDER_REPLICATE);
+    FilterPlan::FilterPlan(NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric, cv::Size imageSize)
+        : m_imageSize(imageSize), m_storage(STORAGE_FLOAT32), m_separable(false), m_lutScale(0.0f)
+    {
+        switch (noiseReductionAlgorithm)
+        {
+        case NR_MOVING_AVERAGE_FILTER:
+            // Create a kernel with all elements equal to 1/(kSize*kSize)
+            initConvolution(cv::Mat_<float>(cv::Mat::ones(kSize, kSize, CV_32FC1) / (float)(kSize * kSize)));
+            break;
+        case NR_MEDIAN_FILTER:
+            if (kSize < 1 || kSize % 2 == 0)
+            {
+                throw std::runtime_error("Window size must be odd");
+            }
+            m_operation = OPERATION_MEDIAN;
+            // sorting 3x3 windows is cheaper than maintaining the sorted window, from 5x5 on the
+            // sliding window wins (see the median backend table of the benchmark)
+            m_backend = kSize >= 5 ? BACKEND_SLIDING_WINDOW : BACKEND_DIRECT;
+            m_windowSize = cv::Size(kSize, kSize);
+            break;
+        case NR_BILATERAL_FILTER:
+        {
+            if (kSize < 1 || kSize % 2 == 0 || sigma_spatial <= 0.0f || sigma_radiometric <= 0.0f)
+            {
+                throw std::runtime_error("Bilateral filter needs an odd window size and positive standard-deviations");
+            }
+            m_operation = OPERATION_BILATERAL;
+            m_backend = BACKEND_DIRECT;
+            m_windowSize = cv::Size(kSize, kSize);
 
-        Mat output = src;
+            // spatial gaussian weights of the window
+            const int border = (kSize - 1) / 2;
+            m_spatialWeights.create(kSize, kSize);
+            for (int k = 0; k < kSize; k++)
+                for (int l = 0; l < kSize; l++)
+                    m_spatialWeights(k, l) = std::exp(-((k - border) * (k - border) + (l - border) * (l - border)) / (2.0f * sigma_spatial * sigma_spatial));
 
-        for (int xp = 0; xp <= src.rows-1; xp++)
-        {
-            for (int yp= 0; yp <= src.cols-1; yp++)
+            // radiometric gaussian weights up to 5 sigma, beyond that they are treated as 0
+            const int lutSize = 4096;
+            m_lutScale = (lutSize - 1) / (5.0f * sigma_radiometric);
+            m_radiometricLut.resize(lutSize);
+            for (int i = 0; i < lutSize; i++)
             {
-                vector<float> values;
+                const float difference = i / m_lutScale;
+                m_radiometricLut[i] = std::exp(-difference * difference / (2.0f * sigma_radiometric * sigma_radiometric));
+            }
+        }
+        break;
+        default:
+            throw std::runtime_error("Unhandled filter type!");
+        }
+        m_tileSize = filterTileSize(m_windowSize.height, m_windowSize.width);
+    }
 
-                for (int xk = 0; xk <= kSize-1; xk++)
-                {
-                    for (int yk=0; yk <= kSize-1; yk++)
-                    {
+    void FilterPlan::initConvolution(const cv::Mat_<float> &kernel)
+    {
+        // pls only use odd kernels and kernals > 1x1
+        if ((kernel.rows <= 1 && kernel.cols <= 1) || kernel.rows % 2 == 0 || kernel.cols % 2 == 0)
+        {
+            throw std::runtime_error("Kernel size must be greater than 1 and of odd size");
+        }
+        m_operation = OPERATION_CONVOLUTION;
+        m_windowSize = kernel.size();
 
-                        values.push_back(src_wb.at<float>(xp+xk,yp+yk));
+        // rotate the kernel by 180 degrees, without touching the caller's kernel
+        cv::flip(kernel, m_kernel, -1);
 
-                    }
-                }
-                std::sort(values.begin(), values.end());
-                // cout << " MedFilter value = " << values[(((kSize*kSize)-1)/2)]  << endl; // is 1 ?
-                output.at<float>(xp,yp) = values[(((kSize*kSize)-1)/2)];
+        // two 1D passes are cheaper than one 2D pass for rank 1 kernels (e.g. the box filter)
+        m_separable = separateKernel(m_kernel, m_rowKernel, m_colKernel);
+        if (kernel.rows * kernel.cols > kernel.rows + kernel.cols && m_separable)
+            m_backend = BACKEND_SEPARABLE;
+        else
+            m_backend = BACKEND_DIRECT;
+        m_tileSize = filterTileSize(m_windowSize.height, m_windowSize.width);
+    }
+
+    void FilterPlan::setBackend(FilterBackend backend)
+    {
+        bool supported = backend == BACKEND_DIRECT;
+        if (backend == BACKEND_SEPARABLE)
+            supported = m_operation == OPERATION_CONVOLUTION && m_separable;
+        if (backend == BACKEND_SLIDING_WINDOW)
+            supported = m_operation == OPERATION_MEDIAN;
+
+        if (!supported)
+        {
+            throw std::runtime_error("Filter backend not supported by this plan");
+        }
+        m_backend = backend;
+    }
 
+    void FilterPlan::setStorage(StoragePrecision storage)
+    {
+        m_storage = storage;
+        // drop the buffers of the previous precision
+        m_padded.release();
+        m_paddedHalf.release();
+        m_intermediate.release();
+        m_intermediateHalf.release();
+    }
+
+    void FilterPlan::execute(const cv::Mat_<float> &src, cv::Mat_<float> &dst)
+    {
+        if (src.size() != m_imageSize)
+        {
+            throw std::runtime_error("Image size doesn't match the filter plan");
+        }
+
+        // Add the border to the (reused) padded buffer
+        const int borderY = (m_windowSize.height - 1) / 2;
+        const int borderX = (m_windowSize.width - 1) / 2;
+        StoredImage padded = {m_storage, m_padded, m_paddedHalf};
+        storePadded(src, borderY, borderX, padded);
+
+        // only the padded copy is read from here on, so dst may be src
+        dst.create(src.rows, src.cols);
+
+        switch (m_operation)
+        {
+        case OPERATION_CONVOLUTION:
+            if (m_backend == BACKEND_SEPARABLE)
+            {
+                StoredImage intermediate = {m_storage, m_intermediate, m_intermediateHalf};
+                convolveSeparable(padded, m_rowKernel, m_colKernel, m_tileSize, intermediate, dst);
             }
+            else
+                convolveDirect(padded, m_kernel, m_tileSize, dst);
+            break;
+        case OPERATION_MEDIAN:
+            if (m_backend == BACKEND_SLIDING_WINDOW)
+                medianSliding(padded, m_windowSize.width, m_tileSize, dst);
+            else
+                medianDirect(padded, m_windowSize.width, m_tileSize, dst);
+            break;
+        case OPERATION_BILATERAL:
+            bilateralDirect(padded, m_spatialWeights, m_radiometricLut, m_lutScale, m_tileSize, dst);
+            break;
         }
+    }
 
+    cv::Mat_<float> FilterPlan::execute(const cv::Mat_<float> &src)
+    {
+        cv::Mat_<float> dst;
+        execute(src, dst);
+        return dst;
+    }
 
-        //  cout << " MedFilter kSize= " << kSize  << endl; // is 1 ?
-        imwrite("test_med.jpg", output); // why is pic so dark?
-        return output;
+    std::string FilterPlan::describe() const
+    {
+        static const char *operationNames[] = {"convolution", "median", "bilateral"};
+        std::stringstream description;
+        description << operationNames[m_operation] << " " << m_windowSize.width << "x" << m_windowSize.height
+                    << ", backend " << filterBackendNames[m_backend]
+                    << ", storage " << storagePrecisionNames[m_storage]
+                    << ", image " << m_imageSize.width << "x" << m_imageSize.height
+                    << ", tile " << m_tileSize.width << "x" << m_tileSize.height;
+        return description.str();
+    }
+
+    /**
+     * @brief Convolution in spatial domain.
+     * @details Performs spatial convolution of image and filter kernel.
+     *          The image is processed in tiles which, including their halo, fit into the L2 cache.
+     * @params src Input image
+     * @params kernel Filter kernel
+     * @returns Convolution result
+     */
+    cv::Mat_<float> spatialConvolution(const cv::Mat_<float> &src, const cv::Mat_<float> &kernel)
+    {
+        return FilterPlan(kernel, src.size()).execute(src);
+    }
+
+    /**
+     * @brief Moving average filter (aka box filter)
+     * @note: you might want to use Dip2::spatialConvolution(...) within this function
+     * @param src Input image
+     * @param kSize Window size used by local average
+     * @returns Filtered image
+     */
+    cv::Mat_<float> averageFilter(const cv::Mat_<float> &src, int kSize)
+    {
+        return FilterPlan(NR_MOVING_AVERAGE_FILTER, kSize, 0.0f, 0.0f, src.size()).execute(src);
+    }
+
+    /**
+     * @brief Median filter
+     * @param src Input image
+     * @param kSize Window size used by median operation
+     * @returns Filtered image
+     */
+    cv::Mat_<float> medianFilter(const cv::Mat_<float>& src, int kSize)
+    {
+        return FilterPlan(NR_MEDIAN_FILTER, kSize, 0.0f, 0.0f, src.size()).execute(src);
     }
 
     /**
@@ -140,9 +823,7 @@ namespace dip2
      */
     cv::Mat_<float> bilateralFilter(const cv::Mat_<float> &src, int kSize, float sigma_spatial, float sigma_radiometric)
     {
-        cv::Mat kernel = cv::Mat::ones(kSize, kSize, CV_32FC1) / (float)(kSize * kSize); // Create a kernel with all elements equal to 1/(kSize*kSize)
-        // std::cout << kernel << std::endl;
-        return spatialConvolution(src, kernel);
+        return FilterPlan(NR_BILATERAL_FILTER, kSize, sigma_spatial, sigma_radiometric, src.size()).execute(src);
     }
 
     /**
@@ -158,6 +839,144 @@ namespace dip2
         return src.clone();
     }
 
+    /**
+     * @brief Applies one of the basic noise reduction filters with explicitly given parameters
+     * @param src Input image
+     * @param noiseReductionAlgorithm Filter to apply
+     * @param kSize Window size
+     * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+     * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+     * @returns Filtered image
+     */
+    cv::Mat_<float> applyFilter(const cv::Mat_<float> &src, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric)
+    {
+        switch (noiseReductionAlgorithm)
+        {
+        case NR_MOVING_AVERAGE_FILTER:
+            return averageFilter(src, kSize);
+        case NR_MEDIAN_FILTER:
+            return medianFilter(src, kSize);
+        case NR_BILATERAL_FILTER:
+            return bilateralFilter(src, kSize, sigma_spatial, sigma_radiometric);
+        default:
+            throw std::runtime_error("Unhandled filter type!");
+        }
+    }
+
+    /**
+     * @brief Applies one of the basic noise reduction filters with explicitly given parameters and scratch buffer precision
+     * @param src Input image
+     * @param noiseReductionAlgorithm Filter to apply
+     * @param kSize Window size
+     * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+     * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+     * @param storage Precision of the scratch buffers
+     * @returns Filtered image
+     */
+    cv::Mat_<float> applyFilter(const cv::Mat_<float> &src, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric, StoragePrecision storage)
+    {
+        if (storage == STORAGE_FLOAT32)
+        {
+            return applyFilter(src, noiseReductionAlgorithm, kSize, sigma_spatial, sigma_radiometric);
+        }
+        FilterPlan plan(noiseReductionAlgorithm, kSize, sigma_spatial, sigma_radiometric, src.size());
+        plan.setStorage(storage);
+        return plan.execute(src);
+    }
+
+    /**
+     * @brief Multi-scale (Laplacian pyramid) noise reduction
+     * @details Decomposes the image into a Laplacian pyramid, filters every band with a small kernel
+     *          and collapses the pyramid again. The levels are filtered one after another.
+     * @param src Input image
+     * @param noiseReductionAlgorithm Filter applied to every pyramid level
+     * @param levels Maximal number of pyramid levels (1 means plain single level filtering)
+     * @param kSize Window size used on every level
+     * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+     * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+     * @returns Filtered image
+     */
+    cv::Mat_<float> pyramidFilter(const cv::Mat_<float> &src, NoiseReductionAlgorithm noiseReductionAlgorithm, int levels, int kSize, float sigma_spatial, float sigma_radiometric)
+    {
+        return pyramidFilter(src, noiseReductionAlgorithm, levels, kSize, sigma_spatial, sigma_radiometric, STORAGE_FLOAT32);
+    }
+
+    /**
+     * @brief Multi-scale (Laplacian pyramid) noise reduction with reduced memory footprint
+     * @details The Gaussian levels below the input and the filtered bands are kept in the given storage
+     *          precision, only the level being processed is decoded to float.
+     * @param src Input image
+     * @param noiseReductionAlgorithm Filter applied to every pyramid level
+     * @param levels Maximal number of pyramid levels (1 means plain single level filtering)
+     * @param kSize Window size used on every level
+     * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+     * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+     * @param storage Precision of the stored pyramid levels and of the filter scratch buffers
+     * @returns Filtered image
+     */
+    cv::Mat_<float> pyramidFilter(const cv::Mat_<float> &src, NoiseReductionAlgorithm noiseReductionAlgorithm, int levels, int kSize, float sigma_spatial, float sigma_radiometric, StoragePrecision storage)
+    {
+        if (levels < 1)
+        {
+            throw std::runtime_error("Number of pyramid levels must be at least 1");
+        }
+
+        // Gaussian pyramid, stop early once a level would get smaller than the kernel.
+        // The input itself is never converted, it already exists as float.
+        std::vector<StoredLevel> gaussian(1);
+        gaussian[0].data32 = src;
+        std::vector<cv::Size> sizes(1, src.size());
+        cv::Mat_<float> current = src;
+        while ((int)sizes.size() < levels && current.rows / 2 >= kSize && current.cols / 2 >= kSize)
+        {
+            cv::Mat_<float> down;
+            cv::pyrDown(current, down);
+            gaussian.push_back(StoredLevel());
+            storeLevel(down, storage, gaussian.back());
+            sizes.push_back(down.size());
+            current = down;
+        }
+        current.release();
+        const int numLevels = (int)sizes.size();
+
+        // Build and filter the Laplacian bands, the coarsest level keeps the low-pass residual.
+        // The levels are processed one after another: the filters are parallel over their tiles, and
+        // OpenCV would run them sequentially if called from within a parallel loop over the levels.
+        // A Gaussian level is dropped as soon as both bands using it are built.
+        std::vector<StoredLevel> bands(numLevels);
+        cv::Mat_<float> fine = src;
+        for (int l = 0; l < numLevels; l++)
+        {
+            cv::Mat_<float> band;
+            cv::Mat_<float> coarse;
+            if (l + 1 < numLevels)
+            {
+                coarse = loadLevel(gaussian[l + 1], storage);
+                cv::Mat_<float> up;
+                cv::pyrUp(coarse, up, sizes[l]);
+                band = fine - up;
+            }
+            else
+            {
+                band = fine;
+            }
+            storeLevel(applyFilter(band, noiseReductionAlgorithm, kSize, sigma_spatial, sigma_radiometric, storage), storage, bands[l]);
+            gaussian[l] = StoredLevel();
+            fine = coarse;
+        }
+
+        // Collapse the pyramid from coarse to fine
+        cv::Mat_<float> result = loadLevel(bands[numLevels - 1], storage);
+        for (int l = numLevels - 2; l >= 0; l--)
+        {
+            cv::Mat_<float> up;
+            cv::pyrUp(result, up, sizes[l]);
+            result = up + loadLevel(bands[l], storage);
+            bands[l] = StoredLevel();
+        }
+        return result;
+    }
+
     /**
      * @brief Chooses the right algorithm for the given noise type
      * @note: Figure out what kind of noise NOISE_TYPE_1 and NOISE_TYPE_2 are and select the respective "right" algorithms.
@@ -168,7 +987,7 @@ namespace dip2
         return (NoiseReductionAlgorithm)-1;
     }
 
-    cv::Mat_<float> denoiseImage(const cv::Mat_<float> &src, NoiseType noiseType, dip2::NoiseReductionAlgorithm noiseReductionAlgorithm)
+    FilterParameters denoiseParameters(NoiseType noiseType, dip2::NoiseReductionAlgorithm noiseReductionAlgorithm)
     {
         // TO DO !!
 
@@ -180,9 +999,9 @@ namespace dip2
             switch (noiseType)
             {
             case NOISE_TYPE_1:
-                return dip2::averageFilter(src, 3);
+                return {3, 0.0f, 0.0f};
             case NOISE_TYPE_2:
-                return dip2::averageFilter(src, 3);
+                return {3, 0.0f, 0.0f};
             default:
                 throw std::runtime_error("Unhandled noise type!");
             }
@@ -190,9 +1009,9 @@ namespace dip2
             switch (noiseType)
             {
             case NOISE_TYPE_1:
-                return dip2::medianFilter(src, 3);
+                return {3, 0.0f, 0.0f};
             case NOISE_TYPE_2:
-                return dip2::medianFilter(src, 3);
+                return {3, 0.0f, 0.0f};
             default:
                 throw std::runtime_error("Unhandled noise type!");
             }
@@ -200,9 +1019,9 @@ namespace dip2
             switch (noiseType)
             {
             case NOISE_TYPE_1:
-                return dip2::bilateralFilter(src, 33, 1.0f, 1.0f);
+                return {9, 3.0f, 200.0f};
             case NOISE_TYPE_2:
-                return dip2::bilateralFilter(src, 33, 1.0f, 1.0f);
+                return {7, 1.5f, 150.0f};
             default:
                 throw std::runtime_error("Unhandled noise type!");
             }
@@ -211,6 +1030,12 @@ namespace dip2
         }
     }
 
+    cv::Mat_<float> denoiseImage(const cv::Mat_<float> &src, NoiseType noiseType, dip2::NoiseReductionAlgorithm noiseReductionAlgorithm)
+    {
+        const FilterParameters params = denoiseParameters(noiseType, noiseReductionAlgorithm);
+        return applyFilter(src, noiseReductionAlgorithm, params.kSize, params.sigma_spatial, params.sigma_radiometric);
+    }
+
     // Helpers, don't mind these
 
     const char *noiseTypeNames[NUM_NOISE_TYPES] = {
@@ -224,4 +1049,16 @@ namespace dip2
         "NR_BILATERAL_FILTER",
     };
 
+    const char *filterBackendNames[NUM_BACKENDS] = {
+        "BACKEND_DIRECT",
+        "BACKEND_SEPARABLE",
+        "BACKEND_SLIDING_WINDOW",
+    };
+
+    const char *storagePrecisionNames[NUM_STORAGE_PRECISIONS] = {
+        "STORAGE_FLOAT32",
+        "STORAGE_FLOAT16",
+        "STORAGE_BFLOAT16",
+    };
+
 }
@@ -6,10 +6,14 @@
 // Description : header file for second DIP assignment
 //============================================================================
 
+#ifndef DIP2_H
+#define DIP2_H
 
 #include <opencv2/opencv.hpp>
 
 #include <iostream>
+#include <string>
+#include <vector>
 
 namespace dip2 {
 
@@ -30,12 +34,66 @@ enum NoiseReductionAlgorithm {
 
 extern const char *noiseReductionAlgorithmNames[NUM_FILTERS];
 
+enum FilterBackend {
+    BACKEND_DIRECT,    /// Direct evaluation of the whole filter window, cache tiled
+    BACKEND_SEPARABLE, /// Row pass followed by a column pass, for separable (rank 1) convolution kernels
+    BACKEND_SLIDING_WINDOW, /// Median: sorted window updated column by column instead of sorted per pixel (exact for any float data)
+    NUM_BACKENDS
+};
+
+extern const char *filterBackendNames[NUM_BACKENDS];
+
+enum StoragePrecision {
+    STORAGE_FLOAT32,  /// Scratch buffers hold float pixels
+    STORAGE_FLOAT16,  /// IEEE half precision: 11 significant bits, exact for integer grey values, ~0.06 step above 128
+    STORAGE_BFLOAT16, /// Upper half of a float: 8 significant bits, same range as float
+    NUM_STORAGE_PRECISIONS
+};
+
+extern const char *storagePrecisionNames[NUM_STORAGE_PRECISIONS];
+
 // function headers of functions to be implemented
 // --> please edit ONLY these functions!
 
+/**
+ * @brief Size of the L2 cache in bytes
+ * @details Detected once at first use, falls back to 256 KiB if the system doesn't tell.
+ */
+std::size_t cacheSizeL2();
+
+/**
+ * @brief Tile size used by the tiled filters
+ * @details Chosen such that a tile of float pixels plus the halo of the filter window fits into half of the L2 cache.
+ * @param kernelRows Height of the filter window
+ * @param kernelCols Width of the filter window
+ * @returns Tile size (without halo)
+ */
+cv::Size filterTileSize(int kernelRows, int kernelCols);
+
+/**
+ * @brief Keeps the filters on the calling thread while the object lives
+ * @details The filters distribute their tiles over OpenCV's thread pool (cv::parallel_for_). Code that runs
+ *          several filters concurrently on threads of its own (see AsyncDenoiser) uses this to run each filter
+ *          sequentially on its thread instead of having all of them compete for OpenCV's pool.
+ *          Only affects the thread that created the object, scopes can be nested.
+ */
+class SerialFilterScope
+{
+    public:
+        SerialFilterScope();
+        ~SerialFilterScope();
+
+        SerialFilterScope(const SerialFilterScope&) = delete;
+        SerialFilterScope& operator=(const SerialFilterScope&) = delete;
+
+    private:
+        bool m_previous;
+};
+
 /**
  * @brief Convolution in spatial domain.
  * @details Performs spatial convolution of image and filter kernel.
+ *          The image is processed in tiles which, including their halo, fit into the L2 cache.
  * @params src Input image
  * @params kernel Filter kernel
  * @returns Convolution result
@@ -80,12 +138,73 @@ cv::Mat_<float> bilateralFilter(const cv::Mat_<float>& src, int kSize, float sig
  */
 cv::Mat_<float> nlmFilter(const cv::Mat_<float>& src, int searchSize, double sigma);
 
+/**
+ * @brief Applies one of the basic noise reduction filters with explicitly given parameters
+ * @param src Input image
+ * @param noiseReductionAlgorithm Filter to apply
+ * @param kSize Window size
+ * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+ * @returns Filtered image
+ */
+cv::Mat_<float> applyFilter(const cv::Mat_<float>& src, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric);
+
+/**
+ * @brief Applies one of the basic noise reduction filters with explicitly given parameters and scratch buffer precision
+ * @details Same as above, but the padded and intermediate scratch buffers of the filter are stored in the given
+ *          precision (see FilterPlan::setStorage(...)). The result is always float.
+ * @param storage Precision of the scratch buffers
+ */
+cv::Mat_<float> applyFilter(const cv::Mat_<float>& src, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric, StoragePrecision storage);
+
+/**
+ * @brief Multi-scale (Laplacian pyramid) noise reduction
+ * @details Decomposes the image into a Laplacian pyramid, filters every band with a small kernel
+ *          and collapses the pyramid again. A kSize x kSize window on level l covers roughly
+ *          kSize*2^l pixels of the input, so this is a cheap alternative to very large kernels.
+ *          The levels are filtered one after another, each one parallel over its tiles.
+ * @param src Input image
+ * @param noiseReductionAlgorithm Filter applied to every pyramid level
+ * @param levels Maximal number of pyramid levels (1 means plain single level filtering)
+ * @param kSize Window size used on every level
+ * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+ * @returns Filtered image
+ */
+cv::Mat_<float> pyramidFilter(const cv::Mat_<float>& src, NoiseReductionAlgorithm noiseReductionAlgorithm, int levels, int kSize, float sigma_spatial, float sigma_radiometric);
+
+/**
+ * @brief Multi-scale (Laplacian pyramid) noise reduction with reduced memory footprint
+ * @details Same as above, but the Gaussian levels below the input, the filtered Laplacian bands and the
+ *          scratch buffers of the filters are stored in the given precision. Only the level currently
+ *          being processed is held as float. With a 16 bit precision this halves the memory the pyramid
+ *          keeps alive, at the cost of the rounding error of that precision (see StoragePrecision).
+ * @param storage Precision of the stored pyramid levels and of the filter scratch buffers
+ */
+cv::Mat_<float> pyramidFilter(const cv::Mat_<float>& src, NoiseReductionAlgorithm noiseReductionAlgorithm, int levels, int kSize, float sigma_spatial, float sigma_radiometric, StoragePrecision storage);
+
 /**
  * @brief Chooses the right algorithm for the given noise type
  * @note: Figure out what kind of noise NOISE_TYPE_1 and NOISE_TYPE_2 are and select the respective "right" algorithms.
  */
 NoiseReductionAlgorithm chooseBestAlgorithm(NoiseType noiseType);
 
+/**
+ * @brief Parameters of one of the basic noise reduction filters (see applyFilter(...))
+ */
+struct FilterParameters
+{
+    int kSize;                  /// Window size
+    float sigma_spatial;        /// Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+    float sigma_radiometric;    /// Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+};
+
+/**
+ * @brief Filter parameters used by denoiseImage(...) for the given noise type and algorithm
+ * @details Allows to apply exactly the filter of denoiseImage(...) to parts of an image, e.g. with filterRegion(...).
+ */
+FilterParameters denoiseParameters(NoiseType noiseType, dip2::NoiseReductionAlgorithm noiseReductionAlgorithm);
+
 /**
  * @brief Denoising, with parameters specifically tweaked to the two noise types.
  * @note: Figure out reasonable denoising parameters for each algorithm-noise combination.
@@ -93,4 +212,104 @@ NoiseReductionAlgorithm chooseBestAlgorithm(NoiseType noiseType);
 cv::Mat_<float> denoiseImage(const cv::Mat_<float> &src, NoiseType noiseType, dip2::NoiseReductionAlgorithm noiseReductionAlgorithm);
 
 
+/**
+ * @brief Precomputed filter for repeated use on images of the same size (e.g. video frames)
+ * @details All setup work is done once when the plan is created: the kernel gets flipped (into the plan,
+ *          the caller's kernel stays untouched), separable kernels are split into their 1D factors,
+ *          the bilateral weights are tabulated and the backend and tile size are chosen.
+ *          execute(...) then only pads the image into a reused scratch buffer and runs the filter.
+ *          The scratch buffers make execute(...) non-reentrant: use one plan per thread.
+ */
+class FilterPlan
+{
+    public:
+        /**
+         * @brief Plan for the convolution with an arbitrary kernel (see spatialConvolution(...))
+         * @param kernel Filter kernel
+         * @param imageSize Size of the images the plan will be executed on
+         */
+        FilterPlan(const cv::Mat_<float>& kernel, cv::Size imageSize);
+
+        /**
+         * @brief Plan for one of the basic noise reduction filters
+         * @param noiseReductionAlgorithm Filter to apply
+         * @param kSize Window size
+         * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+         * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+         * @param imageSize Size of the images the plan will be executed on
+         */
+        FilterPlan(NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric, cv::Size imageSize);
+
+        /**
+         * @brief Filters an image
+         * @param src Input image, must have the size the plan was created for
+         * @param dst Output image, (re)allocated if needed, may be src
+         */
+        void execute(const cv::Mat_<float>& src, cv::Mat_<float>& dst);
+
+        /**
+         * @brief Filters an image into a newly allocated result
+         * @param src Input image, must have the size the plan was created for
+         * @returns Filtered image
+         */
+        cv::Mat_<float> execute(const cv::Mat_<float>& src);
+
+        FilterBackend backend() const { return m_backend; }
+
+        /**
+         * @brief Overrides the automatically chosen backend
+         * @details BACKEND_DIRECT is always supported, BACKEND_SEPARABLE only for separable convolution kernels
+         *          and BACKEND_SLIDING_WINDOW only for the median filter. Throws for unsupported backends.
+         */
+        void setBackend(FilterBackend backend);
+
+        StoragePrecision storage() const { return m_storage; }
+
+        /**
+         * @brief Precision of the scratch buffers (padded source, intermediate of the separable backend)
+         * @details The 16 bit precisions halve the memory footprint and traffic of the scratch buffers at the
+         *          cost of rounding the stored values. The filters convert each tile to float (using F16C if
+         *          available) and compute and accumulate in float, the result is always float.
+         */
+        void setStorage(StoragePrecision storage);
+        cv::Size imageSize() const { return m_imageSize; }
+        cv::Size windowSize() const { return m_windowSize; }
+        cv::Size tileSize() const { return m_tileSize; }
+
+        /// Human readable summary of the plan (operation, backend, sizes)
+        std::string describe() const;
+
+    private:
+        enum Operation {
+            OPERATION_CONVOLUTION,
+            OPERATION_MEDIAN,
+            OPERATION_BILATERAL
+        };
+
+        Operation m_operation;
+        FilterBackend m_backend;
+        cv::Size m_imageSize;
+        cv::Size m_windowSize;
+        cv::Size m_tileSize;
+        StoragePrecision m_storage;
+
+        cv::Mat_<float> m_kernel;              // flipped convolution kernel
+        bool m_separable;                      // convolution kernel has rank 1
+        std::vector<float> m_rowKernel;        // 1D factors of a separable (flipped) kernel
+        std::vector<float> m_colKernel;
+        cv::Mat_<float> m_spatialWeights;      // bilateral spatial weights
+        std::vector<float> m_radiometricLut;   // bilateral radiometric weights over |difference| * m_lutScale
+        float m_lutScale;
+
+        cv::Mat_<float> m_padded;              // scratch: source plus border
+        cv::Mat_<float> m_intermediate;        // scratch: result of the separable row pass
+        cv::Mat_<ushort> m_paddedHalf;         // the same scratch buffers for the 16 bit storage precisions
+        cv::Mat_<ushort> m_intermediateHalf;
+
+        void initConvolution(const cv::Mat_<float>& kernel);
+};
+
+
 }
+
+#endif // DIP2_H
@@ -0,0 +1,412 @@
+//============================================================================
+// Name        : NoiseGenerator.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : synthetic noise for test and training images
+//============================================================================
+
+#include "NoiseGenerator.h"
+
+#include <opencv2/core/hal/intrin.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+// the vector code uses the fixed width universal intrinsics with operators (OpenCV 3.4 and 4.x)
+#if CV_SIMD && CV_VERSION_MAJOR < 5
+#define DIP2_NOISE_SIMD
+#endif
+
+namespace dip2
+{
+
+    namespace
+    {
+        // independent random number streams, one per noise model input
+        enum RandomStream {
+            STREAM_IMPULSE,
+            STREAM_GAUSSIAN_1,
+            STREAM_GAUSSIAN_2,
+            STREAM_SPECKLE_1,
+            STREAM_SPECKLE_2,
+            STREAM_POISSON_1,
+            STREAM_POISSON_2,
+            NUM_STREAMS
+        };
+
+        // integer hash with good avalanche behaviour (lowbias32)
+        inline std::uint32_t hash32(std::uint32_t x)
+        {
+            x ^= x >> 16;
+            x *= 0x7feb352dU;
+            x ^= x >> 15;
+            x *= 0x846ca68bU;
+            x ^= x >> 16;
+            return x;
+        }
+
+        std::uint32_t streamKey(std::uint64_t seed, int stream)
+        {
+            return hash32((std::uint32_t)seed ^ hash32((std::uint32_t)(seed >> 32) + (std::uint32_t)stream * 0x9e3779b9U));
+        }
+
+        // uniform random integer in [1, 2^24] for the given counter, u = k * 2^-24 is uniform in (0, 1]
+        inline std::uint32_t randomIndex(std::uint32_t key, std::uint32_t counter)
+        {
+            return (hash32(hash32(counter ^ key) + key) >> 8) + 1;
+        }
+
+        inline float uniformRandom(std::uint32_t key, std::uint32_t counter)
+        {
+            return (float)randomIndex(key, counter) * (1.0f / 16777216.0f);
+        }
+
+        // Coefficients of the polynomial approximations (Cephes logf, sinf and cosf, about 1 ulp). The scalar
+        // functions below and their vector versions in addNoiseRow() perform the same float operations in the same order.
+        const float logCoefficients[9] = {7.0376836292e-2f, -1.1514610310e-1f, 1.1676998740e-1f, -1.2420140846e-1f, 1.4249322787e-1f,
+                                          -1.6668057665e-1f, 2.0000714765e-1f, -2.4999993993e-1f, 3.3333331174e-1f};
+        const float sinCoefficients[3] = {-1.9515295891e-4f, 8.3321608736e-3f, -1.6666654611e-1f};
+        const float cosCoefficients[3] = {2.443315711809948e-5f, -1.388731625493765e-3f, 4.166664568298827e-2f};
+
+        // natural logarithm of x in (0, 1]: x = m * 2^e with m in [sqrt(0.5), sqrt(2)), polynomial in m - 1
+        inline float logUnit(float x)
+        {
+            std::int32_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            std::int32_t e = (bits >> 23) - 126;
+            bits = (bits & 0x007fffff) | 0x3f000000;
+            float m;
+            std::memcpy(&m, &bits, sizeof(m));
+            if (m < 0.70710678f)
+            {
+                e -= 1;
+                m = m + m;
+            }
+            const float f = m - 1.0f;
+            const float z = f * f;
+            float y = logCoefficients[0];
+            for (int i = 1; i < 9; i++)
+                y = y * f + logCoefficients[i];
+            y = y * f * z;
+            const float ef = (float)e;
+            y = y + ef * -2.12194440e-4f;
+            y = y - 0.5f * z;
+            return (f + y) + ef * 0.693359375f;
+        }
+
+        // Sine and cosine of the angle 2 pi k / 2^24. The reduction to a quadrant q and an offset of at most
+        // pi/4 is exact in integer arithmetic, the offset is evaluated with the polynomials.
+        inline void sinCosTurn(std::uint32_t k, float &sinValue, float &cosValue)
+        {
+            const std::int32_t q = (std::int32_t)((k + 0x200000U) >> 22);
+            const float x = (float)((std::int32_t)k - (q << 22)) * (6.2831853f / 16777216.0f);
+            const float z = x * x;
+            float ps = sinCoefficients[0];
+            float pc = cosCoefficients[0];
+            for (int i = 1; i < 3; i++)
+            {
+                ps = ps * z + sinCoefficients[i];
+                pc = pc * z + cosCoefficients[i];
+            }
+            const float s = ps * z * x + x;
+            const float c = pc * z * z - 0.5f * z + 1.0f;
+            // sin(q pi/2 + x) and cos(q pi/2 + x)
+            sinValue = (q & 1) ? c : s;
+            cosValue = (q & 1) ? s : c;
+            if (q & 2)
+                sinValue = -sinValue;
+            if ((q + 1) & 2)
+                cosValue = -cosValue;
+        }
+
+        // Box-Muller: both standard normal random numbers for the uniform random numbers k1 * 2^-24 and k2 * 2^-24
+        inline void gaussianPair(std::uint32_t k1, std::uint32_t k2, float &z1, float &z2)
+        {
+            const float radius = std::sqrt(-2.0f * logUnit((float)k1 * (1.0f / 16777216.0f)));
+            float s, c;
+            sinCosTurn(k2, s, c);
+            z1 = radius * c;
+            z2 = radius * s;
+        }
+
+        // Poisson distributed random number with mean lambda < 30 by inversion of the distribution function, k1 * 2^-24 is uniform in (0, 1]
+        inline float poissonInversion(float lambda, std::uint32_t k1)
+        {
+            // The inversion uses u = 1 - k1 * 2^-24 in [0, 1). The probabilities are computed and summed in double: in float
+            // the sum stalls just below 1 and draws close to 1 would run to the limit. The limit lies 10 standard
+            // deviations above the mean and is never reached by a draw in [0, 1 - 2^-24].
+            const double u = 1.0 - (double)k1 * (1.0 / 16777216.0);
+            const int maxK = (int)(lambda + 10.0f * std::sqrt(lambda)) + 10;
+            double p = std::exp(-(double)lambda);
+            double cdf = p;
+            int k = 0;
+            while (u >= cdf && k < maxK)
+            {
+                k++;
+                p *= (double)lambda / k;
+                cdf += p;
+            }
+            return (float)k;
+        }
+
+        // Poisson distributed random number with mean lambda for the uniform random numbers k1 * 2^-24 and k2 * 2^-24,
+        // by inversion for small and normal approximation for large lambda
+        inline float poisson(float lambda, std::uint32_t k1, std::uint32_t k2)
+        {
+            if (lambda < 30.0f)
+                return poissonInversion(lambda, k1);
+            float z1, z2;
+            gaussianPair(k1, k2, z1, z2);
+            return std::max(0.0f, std::floor(lambda + std::sqrt(lambda) * z1 + 0.5f));
+        }
+
+#ifdef DIP2_NOISE_SIMD
+        // vector versions of the functions above, every lane gets the result of the scalar function
+
+        inline cv::v_uint32 v_hash32(cv::v_uint32 x)
+        {
+            x = x ^ (x >> 16);
+            x = x * cv::v_setall_u32(0x7feb352dU);
+            x = x ^ (x >> 15);
+            x = x * cv::v_setall_u32(0x846ca68bU);
+            x = x ^ (x >> 16);
+            return x;
+        }
+
+        inline cv::v_int32 v_randomIndex(std::uint32_t key, const cv::v_uint32 &counter)
+        {
+            const cv::v_uint32 k = cv::v_setall_u32(key);
+            return cv::v_reinterpret_as_s32((v_hash32(v_hash32(counter ^ k) + k) >> 8) + cv::v_setall_u32(1));
+        }
+
+        inline cv::v_float32 v_uniformRandom(std::uint32_t key, const cv::v_uint32 &counter)
+        {
+            return cv::v_cvt_f32(v_randomIndex(key, counter)) * cv::v_setall_f32(1.0f / 16777216.0f);
+        }
+
+        inline cv::v_float32 v_logUnit(const cv::v_float32 &x)
+        {
+            const cv::v_int32 bits = cv::v_reinterpret_as_s32(x);
+            cv::v_int32 e = (bits >> 23) - cv::v_setall_s32(126);
+            cv::v_float32 m = cv::v_reinterpret_as_f32((bits & cv::v_setall_s32(0x007fffff)) | cv::v_setall_s32(0x3f000000));
+            const cv::v_float32 small = m < cv::v_setall_f32(0.70710678f);
+            // the mask is -1 in the lanes to correct
+            e = e + cv::v_reinterpret_as_s32(small);
+            m = cv::v_select(small, m + m, m);
+            const cv::v_float32 f = m - cv::v_setall_f32(1.0f);
+            const cv::v_float32 z = f * f;
+            cv::v_float32 y = cv::v_setall_f32(logCoefficients[0]);
+            for (int i = 1; i < 9; i++)
+                y = y * f + cv::v_setall_f32(logCoefficients[i]);
+            y = y * f * z;
+            const cv::v_float32 ef = cv::v_cvt_f32(e);
+            y = y + ef * cv::v_setall_f32(-2.12194440e-4f);
+            y = y - cv::v_setall_f32(0.5f) * z;
+            return (f + y) + ef * cv::v_setall_f32(0.693359375f);
+        }
+
+        inline void v_sinCosTurn(const cv::v_int32 &k, cv::v_float32 &sinValue, cv::v_float32 &cosValue)
+        {
+            const cv::v_int32 one = cv::v_setall_s32(1);
+            const cv::v_int32 two = cv::v_setall_s32(2);
+            const cv::v_int32 q = (k + cv::v_setall_s32(0x200000)) >> 22;
+            const cv::v_float32 x = cv::v_cvt_f32(k - (q << 22)) * cv::v_setall_f32(6.2831853f / 16777216.0f);
+            const cv::v_float32 z = x * x;
+            cv::v_float32 ps = cv::v_setall_f32(sinCoefficients[0]);
+            cv::v_float32 pc = cv::v_setall_f32(cosCoefficients[0]);
+            for (int i = 1; i < 3; i++)
+            {
+                ps = ps * z + cv::v_setall_f32(sinCoefficients[i]);
+                pc = pc * z + cv::v_setall_f32(cosCoefficients[i]);
+            }
+            const cv::v_float32 s = ps * z * x + x;
+            const cv::v_float32 c = pc * z * z - cv::v_setall_f32(0.5f) * z + cv::v_setall_f32(1.0f);
+            // swap for odd quadrants, the signs are flipped through the sign bit (bit 1 of q shifted to bit 31)
+            const cv::v_float32 swap = cv::v_reinterpret_as_f32((q & one) == one);
+            sinValue = cv::v_select(swap, c, s) ^ cv::v_reinterpret_as_f32((q & two) << 30);
+            cosValue = cv::v_select(swap, s, c) ^ cv::v_reinterpret_as_f32(((q + one) & two) << 30);
+        }
+
+        inline void v_gaussianPair(const cv::v_int32 &k1, const cv::v_int32 &k2, cv::v_float32 &z1, cv::v_float32 &z2)
+        {
+            const cv::v_float32 radius = cv::v_sqrt(cv::v_setall_f32(-2.0f) * v_logUnit(cv::v_cvt_f32(k1) * cv::v_setall_f32(1.0f / 16777216.0f)));
+            cv::v_float32 s, c;
+            v_sinCosTurn(k2, s, c);
+            z1 = radius * c;
+            z2 = radius * s;
+        }
+
+        // floor of floats, values from 2^23 on are integers already (and may not fit into an int)
+        inline cv::v_float32 v_floorFloat(const cv::v_float32 &x)
+        {
+            return cv::v_select(x < cv::v_setall_f32(8388608.0f), cv::v_cvt_f32(cv::v_floor(x)), x);
+        }
+
+        // shot noise: normal approximation in all lanes, the inversion with its data dependent number of steps lane by lane
+        inline cv::v_float32 v_shotNoise(const cv::v_float32 &value, float scale, const std::uint32_t *keys, const cv::v_uint32 &counter)
+        {
+            const cv::v_float32 zero = cv::v_setall_f32(0.0f);
+            const cv::v_float32 lambda = cv::v_max(value, zero) * cv::v_setall_f32(scale);
+            const cv::v_int32 k1 = v_randomIndex(keys[STREAM_POISSON_1], counter);
+            cv::v_float32 z1, z2;
+            v_gaussianPair(k1, v_randomIndex(keys[STREAM_POISSON_2], counter), z1, z2);
+            const cv::v_float32 approximation = cv::v_max(zero, v_floorFloat(lambda + cv::v_sqrt(lambda) * z1 + cv::v_setall_f32(0.5f)));
+
+            float lambdas[cv::v_float32::nlanes], counts[cv::v_float32::nlanes];
+            std::uint32_t uniform[cv::v_float32::nlanes];
+            cv::v_store(lambdas, lambda);
+            cv::v_store(counts, approximation);
+            cv::v_store(uniform, cv::v_reinterpret_as_u32(k1));
+            for (int i = 0; i < cv::v_float32::nlanes; i++)
+                if (lambdas[i] < 30.0f)
+                    counts[i] = poissonInversion(lambdas[i], uniform[i]);
+            return cv::v_load(counts) / cv::v_setall_f32(scale);
+        }
+
+        // Box-Muller for the pairs with the given counters, interleaved so that pixels 2i and 2i+1 get the results of pair i
+        inline void v_gaussianPairs(std::uint32_t key1, std::uint32_t key2, const cv::v_uint32 &counter, cv::v_float32 &lo, cv::v_float32 &hi)
+        {
+            cv::v_float32 z1, z2;
+            v_gaussianPair(v_randomIndex(key1, counter), v_randomIndex(key2, counter), z1, z2);
+            cv::v_zip(z1, z2, lo, hi);
+        }
+
+        // clamping to [0, 255] and impulse noise
+        inline cv::v_float32 v_clampAndImpulse(const cv::v_float32 &value, float impulse, std::uint32_t key, const cv::v_uint32 &counter)
+        {
+            cv::v_float32 result = cv::v_min(cv::v_max(value, cv::v_setall_f32(0.0f)), cv::v_setall_f32(255.0f));
+            if (impulse > 0.0f)
+            {
+                const cv::v_float32 u = v_uniformRandom(key, counter);
+                const cv::v_float32 black = u <= cv::v_setall_f32(impulse);
+                const cv::v_float32 white = u > cv::v_setall_f32(1.0f - impulse);
+                result = cv::v_select(black, cv::v_setall_f32(0.0f), cv::v_select(white, cv::v_setall_f32(255.0f), result));
+            }
+            return result;
+        }
+#endif
+
+        // Adds the noise to one row in a single pass: every pixel goes through all enabled models before the next one is loaded.
+        // Speckle and gaussian noise use both results of Box-Muller, pixels 2i and 2i+1 share the uniform random numbers of pair i.
+        void addNoiseRow(float *row, int cols, int y, const std::uint32_t *keys, const NoiseParameters &params)
+        {
+            const float impulse = params.impulseProbability;
+            const float sigma = params.gaussianSigma;
+            const float scale = params.poissonScale;
+            const float speckle = params.speckleSigma;
+            // counters of the first pixel (Poisson, impulse) and of the first pair of pixels (speckle, gaussian) of the row
+            const std::uint32_t first = (std::uint32_t)y * (std::uint32_t)cols;
+            const std::uint32_t firstPair = (std::uint32_t)y * (std::uint32_t)((cols + 1) / 2);
+
+            int x = 0;
+#ifdef DIP2_NOISE_SIMD
+            // two vectors of pixels per step, they share one vector of pairs
+            const int lanes = cv::v_float32::nlanes;
+            std::uint32_t laneIndex[lanes];
+            for (int i = 0; i < lanes; i++)
+                laneIndex[i] = (std::uint32_t)i;
+            const cv::v_uint32 lane = cv::v_load(laneIndex);
+
+            for (; x + 2 * lanes <= cols; x += 2 * lanes)
+            {
+                cv::v_float32 lo = cv::v_load(row + x);
+                cv::v_float32 hi = cv::v_load(row + x + lanes);
+                const cv::v_uint32 counterLo = cv::v_setall_u32(first + (std::uint32_t)x) + lane;
+                const cv::v_uint32 counterHi = counterLo + cv::v_setall_u32((std::uint32_t)lanes);
+                const cv::v_uint32 pair = cv::v_setall_u32(firstPair + (std::uint32_t)x / 2) + lane;
+
+                if (scale > 0.0f)
+                {
+                    lo = v_shotNoise(lo, scale, keys, counterLo);
+                    hi = v_shotNoise(hi, scale, keys, counterHi);
+                }
+                if (speckle > 0.0f)
+                {
+                    cv::v_float32 noiseLo, noiseHi;
+                    v_gaussianPairs(keys[STREAM_SPECKLE_1], keys[STREAM_SPECKLE_2], pair, noiseLo, noiseHi);
+                    lo = lo * (cv::v_setall_f32(1.0f) + cv::v_setall_f32(speckle) * noiseLo);
+                    hi = hi * (cv::v_setall_f32(1.0f) + cv::v_setall_f32(speckle) * noiseHi);
+                }
+                if (sigma > 0.0f)
+                {
+                    cv::v_float32 noiseLo, noiseHi;
+                    v_gaussianPairs(keys[STREAM_GAUSSIAN_1], keys[STREAM_GAUSSIAN_2], pair, noiseLo, noiseHi);
+                    lo = lo + cv::v_setall_f32(sigma) * noiseLo;
+                    hi = hi + cv::v_setall_f32(sigma) * noiseHi;
+                }
+                cv::v_store(row + x, v_clampAndImpulse(lo, impulse, keys[STREAM_IMPULSE], counterLo));
+                cv::v_store(row + x + lanes, v_clampAndImpulse(hi, impulse, keys[STREAM_IMPULSE], counterHi));
+            }
+#endif
+            // remaining pixels pair by pair, the last pixel of an odd row only uses the first result of its pair
+            for (; x < cols; x += 2)
+            {
+                const std::uint32_t pair = firstPair + (std::uint32_t)x / 2;
+                float speckleNoise[2], gaussianNoise[2];
+                if (speckle > 0.0f)
+                    gaussianPair(randomIndex(keys[STREAM_SPECKLE_1], pair), randomIndex(keys[STREAM_SPECKLE_2], pair), speckleNoise[0], speckleNoise[1]);
+                if (sigma > 0.0f)
+                    gaussianPair(randomIndex(keys[STREAM_GAUSSIAN_1], pair), randomIndex(keys[STREAM_GAUSSIAN_2], pair), gaussianNoise[0], gaussianNoise[1]);
+
+                for (int i = 0; i < 2 && x + i < cols; i++)
+                {
+                    const std::uint32_t counter = first + (std::uint32_t)(x + i);
+                    float value = row[x + i];
+                    if (scale > 0.0f)
+                        value = poisson(std::max(value, 0.0f) * scale, randomIndex(keys[STREAM_POISSON_1], counter), randomIndex(keys[STREAM_POISSON_2], counter)) / scale;
+                    if (speckle > 0.0f)
+                        value *= 1.0f + speckle * speckleNoise[i];
+                    if (sigma > 0.0f)
+                        value += sigma * gaussianNoise[i];
+                    value = std::min(std::max(value, 0.0f), 255.0f);
+                    if (impulse > 0.0f)
+                    {
+                        const float u = uniformRandom(keys[STREAM_IMPULSE], counter);
+                        value = u <= impulse ? 0.0f : (u > 1.0f - impulse ? 255.0f : value);
+                    }
+                    row[x + i] = value;
+                }
+            }
+        }
+    }
+
+    NoiseParameters noiseParameters(NoiseType noiseType)
+    {
+        NoiseParameters params = {0.0f, 0.0f, 0.0f, 0.0f};
+        switch (noiseType)
+        {
+        case NOISE_TYPE_1:
+            params.impulseProbability = 0.15f;
+            return params;
+        case NOISE_TYPE_2:
+            params.gaussianSigma = 50.0f;
+            return params;
+        default:
+            throw std::runtime_error("Unhandled noise type!");
+        }
+    }
+
+    void addNoise(cv::Mat_<float> &img, const NoiseParameters &params, std::uint64_t seed)
+    {
+        std::uint32_t keys[NUM_STREAMS];
+        for (int s = 0; s < NUM_STREAMS; s++)
+            keys[s] = streamKey(seed, s);
+
+        cv::parallel_for_(cv::Range(0, img.rows), [&](const cv::Range &range)
+        {
+            for (int y = range.start; y < range.end; y++)
+                addNoiseRow(img[y], img.cols, y, keys, params);
+        });
+    }
+
+    cv::Mat_<float> generateNoisyImage(const cv::Mat_<float> &img, NoiseType noiseType, std::uint64_t seed)
+    {
+        cv::Mat_<float> noisy = img.clone();
+        addNoise(noisy, noiseParameters(noiseType), seed);
+        return noisy;
+    }
+
+}
@@ -0,0 +1,63 @@
+//============================================================================
+// Name        : NoiseGenerator.h
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : synthetic noise for test and training images
+//============================================================================
+
+#ifndef NOISEGENERATOR_H
+#define NOISEGENERATOR_H
+
+#include "Dip2.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <cstdint>
+
+namespace dip2 {
+
+/**
+ * @brief Parameters of the synthetic noise
+ * @details All noise models can be mixed, a value of 0 disables the respective model.
+ *          They are applied in the order shot (Poisson) noise, speckle, additive gaussian noise,
+ *          clamping to [0, 255], impulse noise.
+ */
+struct NoiseParameters
+{
+    float impulseProbability;   /// Probability of a pixel turning black, and independently of turning white (salt and pepper)
+    float gaussianSigma;        /// Standard-deviation of additive gaussian noise
+    float poissonScale;         /// Photons per grey value of the shot noise, larger values mean less noise
+    float speckleSigma;         /// Standard-deviation of the multiplicative (speckle) noise factor around 1
+};
+
+/**
+ * @brief Noise parameters reproducing NOISE_TYPE_1 and NOISE_TYPE_2
+ */
+NoiseParameters noiseParameters(NoiseType noiseType);
+
+/**
+ * @brief Adds synthetic noise to an image in place
+ * @details Rows are processed in parallel, each in a single pass that applies all enabled noise models to a pixel.
+ *          Hashing, Box-Muller and the noise models run on OpenCV's universal intrinsics where available, only the
+ *          inversion for the shot noise (photon counts below 30) runs lane by lane. The random numbers are counter
+ *          based (hash of seed, noise model and pixel position), so the result only depends on the seed and not on
+ *          the number of threads, the processing order or the vector width.
+ * @param img Image to add the noise to
+ * @param params Noise parameters
+ * @param seed Seed of the random numbers
+ */
+void addNoise(cv::Mat_<float>& img, const NoiseParameters& params, std::uint64_t seed);
+
+/**
+ * @brief Generates a noisy copy of an image
+ * @param img Input image
+ * @param noiseType Type of noise to add
+ * @param seed Seed of the random numbers
+ * @returns Noisy image
+ */
+cv::Mat_<float> generateNoisyImage(const cv::Mat_<float>& img, NoiseType noiseType, std::uint64_t seed);
+
+}
+
+#endif // NOISEGENERATOR_H
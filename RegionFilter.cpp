@@ -0,0 +1,124 @@
+//============================================================================
+// Name        : RegionFilter.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : region of interest and incremental (dirty region) filtering
+//============================================================================
+
+#include "RegionFilter.h"
+
+#include <stdexcept>
+
+namespace dip2
+{
+
+    void filterRegion(const cv::Mat_<float> &src, cv::Mat_<float> &dst, const cv::Rect &roi, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric)
+    {
+        if (dst.size() != src.size())
+        {
+            throw std::runtime_error("Output image must have the size of the input image");
+        }
+
+        const cv::Rect image(0, 0, src.cols, src.rows);
+        const cv::Rect region = roi & image;
+        if (region.empty())
+        {
+            return;
+        }
+
+        // Only read the region plus its halo. Where the halo is clipped by the image border, the filter's
+        // own border replication reproduces exactly what it would do on the full image.
+        const int halo = filterHalo(kSize);
+        const cv::Rect input = cv::Rect(region.x - halo, region.y - halo, region.width + 2 * halo, region.height + 2 * halo) & image;
+
+        cv::Mat_<float> filtered = applyFilter(src(input), noiseReductionAlgorithm, kSize, sigma_spatial, sigma_radiometric);
+
+        const cv::Rect inner(region.x - input.x, region.y - input.y, region.width, region.height);
+        cv::Mat_<float> target = dst(region);
+        filtered(inner).copyTo(target);
+    }
+
+    RegionFilter::RegionFilter(NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric)
+        : m_noiseReductionAlgorithm(noiseReductionAlgorithm), m_kSize(kSize), m_sigmaSpatial(sigma_spatial), m_sigmaRadiometric(sigma_radiometric), m_invalid(true)
+    {
+    }
+
+    void RegionFilter::markDirty(const cv::Rect &rect)
+    {
+        if (rect.empty())
+        {
+            return;
+        }
+
+        // a modified source pixel changes every output pixel within the halo around it
+        const int halo = filterHalo(m_kSize);
+        cv::Rect affected(rect.x - halo, rect.y - halo, rect.width + 2 * halo, rect.height + 2 * halo);
+
+        // merge with all overlapping regions, so no output pixel gets filtered twice
+        bool merged = true;
+        while (merged)
+        {
+            merged = false;
+            for (size_t i = 0; i < m_dirty.size(); i++)
+            {
+                if (!(m_dirty[i] & affected).empty())
+                {
+                    affected |= m_dirty[i];
+                    m_dirty.erase(m_dirty.begin() + i);
+                    merged = true;
+                    break;
+                }
+            }
+        }
+        m_dirty.push_back(affected);
+    }
+
+    void RegionFilter::invalidate()
+    {
+        m_invalid = true;
+        m_dirty.clear();
+    }
+
+    const cv::Mat_<float> &RegionFilter::update(const cv::Mat_<float> &src)
+    {
+        if (m_invalid || m_result.size() != src.size())
+        {
+            m_result = applyFilter(src, m_noiseReductionAlgorithm, m_kSize, m_sigmaSpatial, m_sigmaRadiometric);
+            m_invalid = false;
+            m_dirty.clear();
+            return m_result;
+        }
+
+        // The merged dirty regions are disjoint, so they can be written concurrently. But the filters are
+        // already parallel over their tiles and OpenCV runs nested parallel loops sequentially: regions
+        // larger than a filter tile are filtered one after another, each using all threads, and only
+        // the small ones are distributed over the threads.
+        const int tileArea = filterTileSize(m_kSize, m_kSize).area();
+        std::vector<cv::Rect> smallRegions;
+        for (size_t i = 0; i < m_dirty.size(); i++)
+        {
+            if (m_dirty[i].area() > tileArea)
+                filterRegion(src, m_result, m_dirty[i], m_noiseReductionAlgorithm, m_kSize, m_sigmaSpatial, m_sigmaRadiometric);
+            else
+                smallRegions.push_back(m_dirty[i]);
+        }
+        if (smallRegions.size() == 1)
+        {
+            filterRegion(src, m_result, smallRegions[0], m_noiseReductionAlgorithm, m_kSize, m_sigmaSpatial, m_sigmaRadiometric);
+        }
+        else if (smallRegions.size() > 1)
+        {
+            cv::parallel_for_(cv::Range(0, (int)smallRegions.size()), [&](const cv::Range &range)
+            {
+                for (int i = range.start; i < range.end; i++)
+                {
+                    filterRegion(src, m_result, smallRegions[i], m_noiseReductionAlgorithm, m_kSize, m_sigmaSpatial, m_sigmaRadiometric);
+                }
+            });
+        }
+        m_dirty.clear();
+        return m_result;
+    }
+
+}
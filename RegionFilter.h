@@ -0,0 +1,95 @@
+//============================================================================
+// Name        : RegionFilter.h
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : region of interest and incremental (dirty region) filtering
+//============================================================================
+
+#ifndef REGIONFILTER_H
+#define REGIONFILTER_H
+
+#include "Dip2.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+namespace dip2 {
+
+/**
+ * @brief Number of pixels around a pixel that influence its filter result (the halo)
+ * @param kSize Window size of the filter
+ */
+inline int filterHalo(int kSize) { return (kSize - 1) / 2; }
+
+/**
+ * @brief Filters only a region of the image
+ * @details Reads the region plus the halo required by the filter from src and writes the result
+ *          into the same region of dst. Pixels of dst outside of roi are left untouched. The result
+ *          inside roi is identical to filtering the whole image.
+ * @param src Input image
+ * @param dst Output image, must have the size of src
+ * @param roi Region to filter, gets clipped to the image
+ * @param noiseReductionAlgorithm Filter to apply
+ * @param kSize Window size
+ * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+ * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+ */
+void filterRegion(const cv::Mat_<float>& src, cv::Mat_<float>& dst, const cv::Rect& roi, NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric);
+
+/**
+ * @brief Keeps a filtered copy of an image up to date while the image is edited
+ * @details The caller reports modified source regions with markDirty(...). update(...) then only re-filters
+ *          the output regions affected by these modifications (the dirty regions grown by the filter halo).
+ *          Overlapping dirty regions are merged. Large regions are filtered one after another
+ *          with the filter's own tile parallelism, small disjoint ones are processed in parallel.
+ */
+class RegionFilter
+{
+    public:
+        /**
+         * @param noiseReductionAlgorithm Filter to apply
+         * @param kSize Window size
+         * @param sigma_spatial Standard-deviation of the spatial kernel (only used by NR_BILATERAL_FILTER)
+         * @param sigma_radiometric Standard-deviation of the radiometric kernel (only used by NR_BILATERAL_FILTER)
+         */
+        RegionFilter(NoiseReductionAlgorithm noiseReductionAlgorithm, int kSize, float sigma_spatial, float sigma_radiometric);
+
+        /**
+         * @brief Reports a modified region of the source image
+         * @param rect Modified region in source image coordinates
+         */
+        void markDirty(const cv::Rect& rect);
+
+        /// Forces the next update(...) to filter the whole image
+        void invalidate();
+
+        /**
+         * @brief Brings the filtered image up to date
+         * @details The first call, and any call with a source of different size, filters the whole image.
+         * @param src Current source image
+         * @returns Filtered image (stays valid until the next call)
+         */
+        const cv::Mat_<float>& update(const cv::Mat_<float>& src);
+
+        /// Filtered image as of the last update(...)
+        const cv::Mat_<float>& result() const { return m_result; }
+
+        /// Output regions that will be re-filtered by the next update(...)
+        const std::vector<cv::Rect>& dirtyRegions() const { return m_dirty; }
+
+    private:
+        NoiseReductionAlgorithm m_noiseReductionAlgorithm;
+        int m_kSize;
+        float m_sigmaSpatial;
+        float m_sigmaRadiometric;
+
+        cv::Mat_<float> m_result;
+        std::vector<cv::Rect> m_dirty;
+        bool m_invalid;
+};
+
+}
+
+#endif // REGIONFILTER_H
@@ -0,0 +1,271 @@
+//============================================================================
+// Name        : TemporalFilter.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : temporal / spatio-temporal noise reduction for video
+//============================================================================
+
+#include "TemporalFilter.h"
+#include "RegionFilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace dip2
+{
+
+    namespace
+    {
+        // inserts value into the sorted array values[0..count), which must have room for one more element
+        inline void insertSorted(float *values, int count, float value)
+        {
+            int i = count;
+            while (i > 0 && values[i - 1] > value)
+            {
+                values[i] = values[i - 1];
+                i--;
+            }
+            values[i] = value;
+        }
+
+        // bounding box of the non-zero pixels of mask within rect, empty if there are none
+        cv::Rect boundingBox(const cv::Mat_<uchar> &mask, const cv::Rect &rect)
+        {
+            int left = rect.x + rect.width, right = rect.x - 1, top = rect.y + rect.height, bottom = rect.y - 1;
+            for (int y = rect.y; y < rect.y + rect.height; y++)
+            {
+                const uchar *row = mask[y];
+                for (int x = rect.x; x < rect.x + rect.width; x++)
+                {
+                    if (row[x])
+                    {
+                        left = std::min(left, x);
+                        right = std::max(right, x);
+                        top = std::min(top, y);
+                        bottom = std::max(bottom, y);
+                    }
+                }
+            }
+            return right < left ? cv::Rect() : cv::Rect(left, top, right - left + 1, bottom - top + 1);
+        }
+
+        // Regions covering all moving pixels: the mask is divided into blocks, neighbouring blocks with
+        // motion within a row of blocks are joined and shrunk to the bounding box of their moving pixels.
+        // Keeps the spatial filter away from static parts without filtering lots of tiny regions.
+        std::vector<cv::Rect> motionRegions(const cv::Mat_<uchar> &mask, int blockSize)
+        {
+            std::vector<cv::Rect> regions;
+            for (int by = 0; by < mask.rows; by += blockSize)
+            {
+                const int height = std::min(blockSize, mask.rows - by);
+                int runStart = -1;
+                // one step past the last block, which closes a run reaching the right border
+                for (int bx = 0; bx < mask.cols + blockSize; bx += blockSize)
+                {
+                    const bool moving = bx < mask.cols && cv::countNonZero(mask(cv::Rect(bx, by, std::min(blockSize, mask.cols - bx), height))) > 0;
+                    if (moving && runStart < 0)
+                        runStart = bx;
+                    if (!moving && runStart >= 0)
+                    {
+                        const cv::Rect run(runStart, by, std::min(bx, mask.cols) - runStart, height);
+                        regions.push_back(boundingBox(mask, run));
+                        runStart = -1;
+                    }
+                }
+            }
+            return regions;
+        }
+
+        // replaces oldValue by newValue in the sorted array values[0..count) and keeps it sorted
+        inline void replaceSorted(float *values, int count, float oldValue, float newValue)
+        {
+            int i = (int)(std::lower_bound(values, values + count, oldValue) - values);
+            if (newValue > oldValue)
+            {
+                while (i + 1 < count && values[i + 1] < newValue)
+                {
+                    values[i] = values[i + 1];
+                    i++;
+                }
+            }
+            else
+            {
+                while (i > 0 && values[i - 1] > newValue)
+                {
+                    values[i] = values[i - 1];
+                    i--;
+                }
+            }
+            values[i] = newValue;
+        }
+    }
+
+    TemporalFilter::TemporalFilter(TemporalMode mode, int windowSize, float motionThreshold)
+        : m_mode(mode), m_windowSize(windowSize), m_motionThreshold(motionThreshold), m_next(0), m_count(0)
+    {
+        if ((unsigned)mode >= NUM_TEMPORAL_MODES)
+        {
+            throw std::runtime_error("Unhandled temporal mode!");
+        }
+        if (windowSize < 1)
+        {
+            throw std::runtime_error("Temporal window must contain at least one frame");
+        }
+        reset();
+    }
+
+    void TemporalFilter::reset()
+    {
+        // the recursive average never looks at old frames
+        m_frames.assign(m_mode == TEMPORAL_RECURSIVE_AVERAGE ? 0 : m_windowSize, cv::Mat_<float>());
+        m_next = 0;
+        m_count = 0;
+        m_frameSize = cv::Size();
+        m_state.release();
+        m_sorted.clear();
+    }
+
+    cv::Mat_<float> TemporalFilter::process(const cv::Mat_<float> &frame)
+    {
+        cv::Mat_<uchar> motionMask;
+        return update(frame, motionMask);
+    }
+
+    cv::Mat_<float> TemporalFilter::process(const cv::Mat_<float> &frame, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm)
+    {
+        cv::Mat_<uchar> motionMask;
+        cv::Mat_<float> result = update(frame, motionMask);
+
+        // fall back to the spatial filter where temporal filtering would smear moving content,
+        // only the regions around moving pixels get filtered
+        if (cv::countNonZero(motionMask) > 0)
+        {
+            const FilterParameters params = denoiseParameters(noiseType, noiseReductionAlgorithm);
+            const std::vector<cv::Rect> regions = motionRegions(motionMask, 64);
+            cv::Mat_<float> spatial(frame.rows, frame.cols);
+            // the regions are disjoint and each of them covers only a few filter tiles
+            cv::parallel_for_(cv::Range(0, (int)regions.size()), [&](const cv::Range &range)
+            {
+                for (int i = range.start; i < range.end; i++)
+                {
+                    const cv::Rect &region = regions[i];
+                    filterRegion(frame, spatial, region, noiseReductionAlgorithm, params.kSize, params.sigma_spatial, params.sigma_radiometric);
+                    cv::Mat_<float> target = result(region);
+                    spatial(region).copyTo(target, motionMask(region));
+                }
+            });
+        }
+        return result;
+    }
+
+    cv::Mat_<float> TemporalFilter::update(const cv::Mat_<float> &frame, cv::Mat_<uchar> &motionMask)
+    {
+        if (frame.empty())
+        {
+            throw std::runtime_error("Empty frame");
+        }
+        // start over if the video geometry changes
+        if (m_count > 0 && frame.size() != m_frameSize)
+        {
+            reset();
+        }
+
+        const int rows = frame.rows;
+        const int cols = frame.cols;
+        const bool first = m_count == 0;
+        const bool full = m_count == m_windowSize;
+        // number of frames in the window including the new one
+        const int count = full ? m_count : m_count + 1;
+        // slot of the oldest frame, which drops out of the window once it is full
+        cv::Mat_<float> *slot = m_frames.empty() ? nullptr : &m_frames[m_next];
+
+        if (first)
+        {
+            if (m_mode == TEMPORAL_WINDOW_MEDIAN)
+                m_sorted.assign((size_t)rows * cols * m_windowSize, 0.0f);
+            else
+                m_state.create(rows, cols);
+        }
+
+        cv::Mat_<float> estimate(rows, cols);
+        motionMask.create(rows, cols);
+
+        const float alpha = 1.0f / count;
+        const float invCount = 1.0f / count;
+
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range &range)
+        {
+            for (int y = range.start; y < range.end; y++)
+            {
+                const float *in = frame[y];
+                const float *old = full && slot ? (*slot)[y] : nullptr;
+                float *state = m_mode == TEMPORAL_WINDOW_MEDIAN ? nullptr : m_state[y];
+                float *out = estimate[y];
+                uchar *moving = motionMask[y];
+
+                for (int x = 0; x < cols; x++)
+                {
+                    float value = 0.0f;
+                    switch (m_mode)
+                    {
+                    case TEMPORAL_RECURSIVE_AVERAGE:
+                        state[x] = first ? in[x] : state[x] + alpha * (in[x] - state[x]);
+                        value = state[x];
+                        break;
+                    case TEMPORAL_WINDOW_AVERAGE:
+                        // running sum: add the new frame, subtract the one leaving the window
+                        state[x] = first ? in[x] : state[x] + in[x] - (full ? old[x] : 0.0f);
+                        value = state[x] * invCount;
+                        break;
+                    case TEMPORAL_WINDOW_MEDIAN:
+                    {
+                        float *values = &m_sorted[((size_t)y * cols + x) * m_windowSize];
+                        if (full)
+                            replaceSorted(values, m_windowSize, old[x], in[x]);
+                        else
+                            insertSorted(values, m_count, in[x]);
+                        value = values[(count - 1) / 2];
+                    }
+                    break;
+                    default:
+                        break;
+                    }
+
+                    const bool isMoving = m_motionThreshold > 0.0f && std::abs(in[x] - value) > m_motionThreshold;
+                    // a moving pixel restarts the recursive average instead of dragging the old content along
+                    if (isMoving && m_mode == TEMPORAL_RECURSIVE_AVERAGE)
+                        state[x] = in[x];
+                    moving[x] = isMoving ? 255 : 0;
+                    out[x] = isMoving ? in[x] : value;
+                }
+            }
+        });
+
+        // the new frame replaces the oldest one, reusing its buffer
+        if (slot)
+            frame.copyTo(*slot);
+        m_frameSize = frame.size();
+        m_next = (m_next + 1) % m_windowSize;
+        if (!full)
+            m_count++;
+
+        // rebuild the running sum once per window to keep floating point drift bounded
+        if (m_mode == TEMPORAL_WINDOW_AVERAGE && m_count == m_windowSize && m_next == 0)
+        {
+            m_state.setTo(0.0f);
+            for (int i = 0; i < m_windowSize; i++)
+                m_state += m_frames[i];
+        }
+
+        return estimate;
+    }
+
+    const char *temporalModeNames[NUM_TEMPORAL_MODES] = {
+        "TEMPORAL_RECURSIVE_AVERAGE",
+        "TEMPORAL_WINDOW_AVERAGE",
+        "TEMPORAL_WINDOW_MEDIAN",
+    };
+
+}
@@ -0,0 +1,94 @@
+//============================================================================
+// Name        : TemporalFilter.h
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : temporal / spatio-temporal noise reduction for video
+//============================================================================
+
+#ifndef TEMPORALFILTER_H
+#define TEMPORALFILTER_H
+
+#include "Dip2.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <vector>
+
+namespace dip2 {
+
+enum TemporalMode {
+    TEMPORAL_RECURSIVE_AVERAGE, /// Exponentially weighted running average with weight 1/windowSize
+    TEMPORAL_WINDOW_AVERAGE,    /// Average over the last windowSize frames
+    TEMPORAL_WINDOW_MEDIAN,     /// Median over the last windowSize frames
+    NUM_TEMPORAL_MODES
+};
+
+extern const char *temporalModeNames[NUM_TEMPORAL_MODES];
+
+/**
+ * @brief Temporal noise reduction over a sliding window of frames
+ * @details Updates the temporal estimate incrementally with every new frame: running average
+ *          for the recursive average, running sum for the window average, per pixel sorted window
+ *          with one insert/delete for the window median. Only the window modes keep a ring buffer
+ *          of the last windowSize frames, they need the frame leaving the window.
+ *          Pixels whose value differs from the temporal estimate by more than motionThreshold
+ *          are considered moving and are taken from the current frame (or its spatially
+ *          denoised version) instead, which prevents ghosting.
+ */
+class TemporalFilter
+{
+    public:
+        /**
+         * @param mode Temporal filter to use
+         * @param windowSize Number of frames in the temporal window
+         * @param motionThreshold Maximal deviation from the temporal estimate before a pixel counts as moving (<= 0 disables motion gating)
+         */
+        TemporalFilter(TemporalMode mode, int windowSize, float motionThreshold);
+
+        /**
+         * @brief Adds a frame to the window and returns its temporally filtered version
+         * @param frame Next video frame, all frames must have the same size
+         * @returns Filtered frame
+         */
+        cv::Mat_<float> process(const cv::Mat_<float>& frame);
+
+        /**
+         * @brief Spatio-temporal noise reduction
+         * @details Like process(frame), but moving pixels are taken from the spatially denoised frame (see denoiseImage(...)).
+         *          The spatial filter is only run on the regions around moving pixels.
+         * @param frame Next video frame, all frames must have the same size
+         * @param noiseType Noise type passed on to denoiseImage(...)
+         * @param noiseReductionAlgorithm Spatial filter passed on to denoiseImage(...)
+         * @returns Filtered frame
+         */
+        cv::Mat_<float> process(const cv::Mat_<float>& frame, NoiseType noiseType, NoiseReductionAlgorithm noiseReductionAlgorithm);
+
+        /// Forgets all previous frames
+        void reset();
+
+        /// Number of frames currently in the window
+        int numFrames() const { return m_count; }
+
+        TemporalMode mode() const { return m_mode; }
+        int windowSize() const { return m_windowSize; }
+
+    private:
+        TemporalMode m_mode;
+        int m_windowSize;
+        float m_motionThreshold;
+
+        std::vector<cv::Mat_<float>> m_frames; // ring buffer of the last frames, empty for TEMPORAL_RECURSIVE_AVERAGE
+        int m_next;                            // ring buffer slot the next frame goes to
+        int m_count;                           // number of frames in the window
+        cv::Size m_frameSize;                  // size of the frames in the window
+
+        cv::Mat_<float> m_state;               // running average resp. running sum
+        std::vector<float> m_sorted;           // per pixel sorted window, windowSize values per pixel
+
+        cv::Mat_<float> update(const cv::Mat_<float>& frame, cv::Mat_<uchar>& motionMask);
+};
+
+}
+
+#endif // TEMPORALFILTER_H
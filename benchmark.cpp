@@ -0,0 +1,298 @@
+//============================================================================
+// Name        : benchmark.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : throughput and memory traffic of the filters
+//============================================================================
+
+#include "Dip2.h"
+#include "NoiseGenerator.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// counts the cache misses of the calling thread, if the kernel allows it (perf_event_paranoid)
+class CacheMissCounter
+{
+    public:
+        CacheMissCounter() : m_fd(-1)
+        {
+#ifdef __linux__
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof(attr));
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.size = sizeof(attr);
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            m_fd = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+        }
+
+        ~CacheMissCounter()
+        {
+#ifdef __linux__
+            if (m_fd >= 0)
+                close(m_fd);
+#endif
+        }
+
+        bool available() const { return m_fd >= 0; }
+
+        void start()
+        {
+#ifdef __linux__
+            if (m_fd >= 0) {
+                ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+                ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        // returns the number of misses since start() or -1 if not available
+        long long stop()
+        {
+            long long count = -1;
+#ifdef __linux__
+            if (m_fd >= 0) {
+                ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+                if (read(m_fd, &count, sizeof(count)) != sizeof(count))
+                    count = -1;
+            }
+#endif
+            return count;
+        }
+
+    private:
+        int m_fd;
+};
+
+struct BenchmarkCase
+{
+    std::string name;
+    int kSize;
+    std::function<dip2::FilterPlan(cv::Size)> plan;
+};
+
+// normalized kernel of rank > 1, so the convolution cannot use the separable backend
+cv::Mat_<float> nonSeparableKernel(int kSize)
+{
+    cv::Mat_<float> kernel(kSize, kSize);
+    for (int k = 0; k < kSize; k++)
+        for (int l = 0; l < kSize; l++)
+            kernel(k, l) = (float)((k * 7 + l * 3) % 5 + 1);
+    return kernel / cv::sum(kernel)[0];
+}
+
+// convolution with the direct backend
+dip2::FilterPlan convolutionPlan(int kSize, cv::Size imageSize)
+{
+    dip2::FilterPlan plan(nonSeparableKernel(kSize), imageSize);
+    plan.setBackend(dip2::BACKEND_DIRECT);
+    return plan;
+}
+
+cv::Mat_<float> randomImage(int rows, int cols)
+{
+    cv::Mat_<float> img(rows, cols);
+    cv::randu(img, 0, 255);
+    return img;
+}
+
+// noise free test image with smooth regions and edges
+cv::Mat_<float> syntheticImage(int rows, int cols)
+{
+    cv::Mat_<float> img(rows, cols);
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < cols; x++)
+            img(y, x) = 127.5f + 60.0f * std::sin(x / 37.0f) * std::cos(y / 23.0f) + ((x / 64 + y / 64) % 2 == 0 ? 50.0f : -50.0f);
+    return img;
+}
+
+float computePSNR(const cv::Mat_<float> &estimate, const cv::Mat_<float> &orig)
+{
+    cv::Mat_<float> diff = estimate - orig;
+    float meanSqrDiff = cv::mean(diff.mul(diff))[0];
+    return 10.0f * std::log10(255 * 255 / meanSqrDiff);
+}
+
+struct StorageCase
+{
+    std::string name;
+    dip2::NoiseReductionAlgorithm algorithm;
+    int kSize;
+    float sigma_spatial;
+    float sigma_radiometric;
+};
+
+}
+
+
+int main(int argc, char** argv)
+{
+    // usage: ./benchmark [threads] [rows]
+    int threads = argc > 1 ? std::atoi(argv[1]) : 1;
+    int rows = argc > 2 ? std::atoi(argv[2]) : 256;
+    cv::setNumThreads(threads);
+
+    const int widths[] = {1024, 8192};
+
+    std::vector<BenchmarkCase> cases = {
+        {"spatialConvolution", 3, [](cv::Size size) { return convolutionPlan(3, size); }},
+        {"spatialConvolution", 15, [](cv::Size size) { return convolutionPlan(15, size); }},
+        {"averageFilter", 3, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_MOVING_AVERAGE_FILTER, 3, 0.0f, 0.0f, size); }},
+        {"averageFilter", 15, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_MOVING_AVERAGE_FILTER, 15, 0.0f, 0.0f, size); }},
+        {"medianFilter", 3, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_MEDIAN_FILTER, 3, 0.0f, 0.0f, size); }},
+        {"medianFilter", 7, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_MEDIAN_FILTER, 7, 0.0f, 0.0f, size); }},
+        {"medianFilter", 15, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_MEDIAN_FILTER, 15, 0.0f, 0.0f, size); }},
+        {"bilateralFilter", 15, [](cv::Size size) { return dip2::FilterPlan(dip2::NR_BILATERAL_FILTER, 15, 3.0f, 30.0f, size); }},
+    };
+
+    CacheMissCounter counter;
+
+    cout << "L2 cache: " << dip2::cacheSizeL2() / 1024 << " KiB, threads: " << cv::getNumThreads() << ", rows: " << rows << endl;
+    if (!counter.available())
+        cout << "cache miss counter not available (see /proc/sys/kernel/perf_event_paranoid)" << endl;
+    else if (cv::getNumThreads() > 1)
+        cout << "note: cache misses are only counted for the calling thread" << endl;
+    cout << "bandwidth: compulsory traffic (read source, write and read padded copy, write result) per second" << endl;
+    cout << endl;
+
+    cout << left << setw(20) << "filter" << right << setw(6) << "kSize" << setw(8) << "width" << setw(24) << "backend" << setw(10) << "tile"
+         << setw(12) << "ms" << setw(12) << "MPixel/s" << setw(12) << "GB/s" << setw(14) << "misses/pixel" << endl;
+
+    for (const BenchmarkCase &c : cases)
+        for (int width : widths) {
+            cv::Mat_<float> img = randomImage(rows, width);
+            dip2::FilterPlan plan = c.plan(img.size());
+            cv::Mat_<float> result;
+            // warm up, allocates the scratch buffers and creates the thread pool
+            plan.execute(img, result);
+
+            counter.start();
+            int64 start = cv::getTickCount();
+            plan.execute(img, result);
+            double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+            long long misses = counter.stop();
+
+            double pixels = (double)img.total();
+            int halo = c.kSize - 1;
+            double bytes = sizeof(float) * (pixels + 2.0 * (rows + halo) * (width + halo) + pixels);
+
+            std::stringstream tileName;
+            tileName << plan.tileSize().width << "x" << plan.tileSize().height;
+
+            cout << left << setw(20) << c.name << right << setw(6) << c.kSize << setw(8) << width
+                 << setw(24) << dip2::filterBackendNames[plan.backend()] << setw(10) << tileName.str()
+                 << setw(12) << fixed << setprecision(2) << seconds * 1e3
+                 << setw(12) << pixels / seconds * 1e-6
+                 << setw(12) << bytes / seconds * 1e-9;
+            if (misses >= 0)
+                cout << setw(14) << setprecision(4) << misses / pixels;
+            else
+                cout << setw(14) << "n/a";
+            cout << endl;
+        }
+
+    // crossover of the median backends, FilterPlan switches to the sliding window from kSize 5 on
+    const int medianSizes[] = {3, 5, 7, 9, 11, 15};
+    cv::Mat_<float> medianInput = randomImage(rows, widths[0]);
+
+    cout << endl;
+    cout << "median backends, width " << widths[0] << endl;
+    cout << endl;
+
+    cout << left << setw(20) << "filter" << right << setw(6) << "kSize" << setw(26) << "backend"
+         << setw(12) << "ms" << setw(12) << "MPixel/s" << endl;
+
+    for (int kSize : medianSizes) {
+        dip2::FilterPlan plan(dip2::NR_MEDIAN_FILTER, kSize, 0.0f, 0.0f, medianInput.size());
+        const dip2::FilterBackend chosen = plan.backend();
+        for (int backend : {dip2::BACKEND_DIRECT, dip2::BACKEND_SLIDING_WINDOW}) {
+            plan.setBackend((dip2::FilterBackend)backend);
+            cv::Mat_<float> result;
+            // warm up, allocates the scratch buffers
+            plan.execute(medianInput, result);
+
+            int64 start = cv::getTickCount();
+            plan.execute(medianInput, result);
+            double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+            std::string backendName = dip2::filterBackendNames[backend];
+            if (backend == chosen)
+                backendName += " *";
+
+            cout << left << setw(20) << "medianFilter" << right << setw(6) << kSize << setw(26) << backendName
+                 << setw(12) << fixed << setprecision(2) << seconds * 1e3
+                 << setw(12) << medianInput.total() / seconds * 1e-6 << endl;
+        }
+    }
+    cout << "(* backend chosen by FilterPlan)" << endl;
+
+    // the same filters with 16 bit scratch buffers
+    const std::vector<StorageCase> storageCases = {
+        {"averageFilter", dip2::NR_MOVING_AVERAGE_FILTER, 15, 0.0f, 0.0f},
+        {"medianFilter", dip2::NR_MEDIAN_FILTER, 7, 0.0f, 0.0f},
+        {"bilateralFilter", dip2::NR_BILATERAL_FILTER, 15, 3.0f, 30.0f},
+    };
+    const int width = widths[sizeof(widths) / sizeof(widths[0]) - 1];
+    cv::Mat_<float> original = syntheticImage(rows, width);
+    cv::Mat_<float> noisy = dip2::generateNoisyImage(original, dip2::NOISE_TYPE_2, 0);
+
+    cout << endl;
+    cout << "storage precision of the scratch buffers, width " << width << endl;
+    cout << "PSNR against the noise free image, loss relative to " << dip2::storagePrecisionNames[dip2::STORAGE_FLOAT32] << endl;
+    cout << endl;
+
+    cout << left << setw(20) << "filter" << right << setw(6) << "kSize" << setw(18) << "storage"
+         << setw(12) << "ms" << setw(12) << "MPixel/s" << setw(12) << "PSNR [dB]" << setw(12) << "loss [dB]" << endl;
+
+    for (const StorageCase &c : storageCases) {
+        dip2::FilterPlan plan(c.algorithm, c.kSize, c.sigma_spatial, c.sigma_radiometric, noisy.size());
+        float referencePSNR = 0.0f;
+        for (int storage = 0; storage < dip2::NUM_STORAGE_PRECISIONS; storage++) {
+            plan.setStorage((dip2::StoragePrecision)storage);
+            cv::Mat_<float> result;
+            // warm up, allocates the scratch buffers
+            plan.execute(noisy, result);
+
+            int64 start = cv::getTickCount();
+            plan.execute(noisy, result);
+            double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+            float psnr = computePSNR(result, original);
+            if (storage == dip2::STORAGE_FLOAT32)
+                referencePSNR = psnr;
+
+            cout << left << setw(20) << c.name << right << setw(6) << c.kSize << setw(18) << dip2::storagePrecisionNames[storage]
+                 << setw(12) << fixed << setprecision(2) << seconds * 1e3
+                 << setw(12) << noisy.total() / seconds * 1e-6
+                 << setw(12) << setprecision(3) << psnr
+                 << setw(12) << referencePSNR - psnr << endl;
+        }
+    }
+
+    return 0;
+}
@@ -9,6 +9,7 @@
 //  g++ -o main main.cpp dip2.cpp -std=c++11 -I/opt/homebrew/Cellar/opencv/4.8.1_1/include/opencv4/ -L/opt/homebrew/Cellar/opencv/4.8.1_1/lib -lopencv_core -lopencv_highgui -lopencv_imgcodecs -lopencv_imgproc
 
 #include "Dip2.h"
+#include "NoiseGenerator.h"
 
 #include <opencv2/opencv.hpp>
 
@@ -36,51 +37,6 @@ cv::Mat_<float> tryLoadImage(const std::string &filename)
     return cv::Mat_<float>(img);
 }
 
-// generates and saves different noisy versions of input image
-/*
-fname:   path to the input image
-*/
-cv::Mat_<float> generateNoisyImage(const cv::Mat_<float> &img, dip2::NoiseType noiseType)
-{
-    // generate images with different types of noise
-    switch (noiseType)
-    {
-    case dip2::NOISE_TYPE_1:
-    {
-        // some temporary images
-        Mat tmp1(img.rows, img.cols, CV_32FC1);
-        Mat tmp2(img.rows, img.cols, CV_32FC1);
-        // first noise operation
-        float noiseLevel = 0.15;
-        randu(tmp1, 0, 1);
-        threshold(tmp1, tmp2, noiseLevel, 1, THRESH_BINARY);
-        multiply(tmp2, img, tmp2);
-        threshold(tmp1, tmp1, 1 - noiseLevel, 1, THRESH_BINARY);
-        tmp1 *= 255;
-        tmp1 = tmp2 + tmp1;
-        threshold(tmp1, tmp1, 255, 255, THRESH_TRUNC);
-        return tmp1;
-    }
-    break;
-    case dip2::NOISE_TYPE_2:
-    {
-        // some temporary images
-        Mat tmp1(img.rows, img.cols, CV_32FC1);
-        Mat tmp2(img.rows, img.cols, CV_32FC1);
-        // second noise operation
-        float noiseLevel = 50;
-        randn(tmp1, 0, noiseLevel);
-        tmp1 = img + tmp1;
-        threshold(tmp1, tmp1, 255, 255, THRESH_TRUNC);
-        threshold(tmp1, tmp1, 0, 0, THRESH_TOZERO);
-        return tmp1;
-    }
-    break;
-    default:
-        throw std::runtime_error("Unhandled noise type!");
-    }
-}
-
 int main(int argc, char **argv)
 {
 
@@ -101,7 +57,7 @@ int main(int argc, char **argv)
     cv::Mat_<float> noisyImage[dip2::NUM_NOISE_TYPES];
     for (unsigned i = 0; i < dip2::NUM_NOISE_TYPES; i++)
     {
-        noisyImage[i] = generateNoisyImage(originalImage, (dip2::NoiseType)i);
+        noisyImage[i] = dip2::generateNoisyImage(originalImage, (dip2::NoiseType)i, 0);
         imwrite(std::string(dip2::noiseTypeNames[i]) + ".jpg", noisyImage[i]);
     }
     cout << "done" << endl;
@@ -0,0 +1,405 @@
+//============================================================================
+// Name        : regression_test.cpp
+// Author      : Ronny Haensch
+// Version     : 2.0
+// Copyright   : -
+// Description : output and throughput regression tests of the filters
+//============================================================================
+
+#include "Dip2.h"
+#include "NoiseGenerator.h"
+
+#include <opencv2/opencv.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+namespace {
+
+// Usage: ./regression_test [check|baseline] [directory] [max slowdown in %] [threads]
+//
+//  check     compares every filter against an independent reference and its throughput against the baseline (default)
+//  baseline  stores the current throughput as baseline, e.g. on a known good state or after an intended change of the speed
+//
+// The references are computed by the test itself, straight from the definitions of the filters (replicated
+// borders, sums in double). The tolerances are derived from the float rounding of the filters, not tuned.
+// Only the throughput baseline is kept in directory (default: regression_data): it is only comparable on the
+// same machine, so it has to be recorded on the machine the check runs on. There is one baseline per number
+// of threads (default: 1).
+
+const int imageSize = 2048;
+const std::uint64_t seed = 1;
+const int repetitions = 3;
+
+// the inputs are clamped to [0, 255], filtered values and Laplacian bands stay within [-255, 255]
+const double maxValue = 255.0;
+
+struct RegressionCase
+{
+    std::string name;
+    dip2::NoiseType noiseType;   // noise of the input image
+    float tolerance;             // maximal absolute difference to the reference
+    std::function<cv::Mat_<float>(const cv::Mat_<float>&)> run;
+    std::function<cv::Mat_<float>(const cv::Mat_<float>&)> reference;
+};
+
+// noise free test image with smooth regions and edges
+cv::Mat_<float> syntheticImage(int rows, int cols)
+{
+    cv::Mat_<float> img(rows, cols);
+    for (int y = 0; y < rows; y++)
+        for (int x = 0; x < cols; x++)
+            img(y, x) = 127.5f + 60.0f * std::sin(x / 37.0f) * std::cos(y / 23.0f) + ((x / 64 + y / 64) % 2 == 0 ? 50.0f : -50.0f);
+    return img;
+}
+
+// convolution (the kernel is applied mirrored) with replicated borders
+cv::Mat_<float> referenceConvolution(const cv::Mat_<float> &src, const cv::Mat_<double> &kernel)
+{
+    const int borderY = kernel.rows / 2;
+    const int borderX = kernel.cols / 2;
+    cv::Mat_<float> padded;
+    cv::copyMakeBorder(src, padded, borderY, borderY, borderX, borderX, cv::BORDER_REPLICATE);
+    cv::Mat_<float> dst(src.size());
+    for (int y = 0; y < src.rows; y++)
+        for (int x = 0; x < src.cols; x++) {
+            double sum = 0.0;
+            for (int k = 0; k < kernel.rows; k++)
+                for (int l = 0; l < kernel.cols; l++)
+                    sum += kernel(kernel.rows - 1 - k, kernel.cols - 1 - l) * padded(y + k, x + l);
+            dst(y, x) = (float)sum;
+        }
+    return dst;
+}
+
+cv::Mat_<float> referenceAverage(const cv::Mat_<float> &src, int kSize)
+{
+    return referenceConvolution(src, cv::Mat_<double>(kSize, kSize, 1.0 / (kSize * kSize)));
+}
+
+// median of the sorted window with replicated borders
+cv::Mat_<float> referenceMedian(const cv::Mat_<float> &src, int kSize)
+{
+    const int border = kSize / 2;
+    cv::Mat_<float> padded;
+    cv::copyMakeBorder(src, padded, border, border, border, border, cv::BORDER_REPLICATE);
+    cv::Mat_<float> dst(src.size());
+    std::vector<float> window(kSize * kSize);
+    for (int y = 0; y < src.rows; y++)
+        for (int x = 0; x < src.cols; x++) {
+            for (int k = 0; k < kSize; k++)
+                for (int l = 0; l < kSize; l++)
+                    window[k * kSize + l] = padded(y + k, x + l);
+            std::sort(window.begin(), window.end());
+            dst(y, x) = window[window.size() / 2];
+        }
+    return dst;
+}
+
+// bilateral filter with exact gaussian weights and replicated borders
+cv::Mat_<float> referenceBilateral(const cv::Mat_<float> &src, int kSize, float sigma_spatial, float sigma_radiometric)
+{
+    const int border = kSize / 2;
+    cv::Mat_<float> padded;
+    cv::copyMakeBorder(src, padded, border, border, border, border, cv::BORDER_REPLICATE);
+    cv::Mat_<float> dst(src.size());
+    for (int y = 0; y < src.rows; y++)
+        for (int x = 0; x < src.cols; x++) {
+            const double centre = padded(y + border, x + border);
+            double weightedSum = 0.0;
+            double weightSum = 0.0;
+            for (int k = 0; k < kSize; k++)
+                for (int l = 0; l < kSize; l++) {
+                    const double value = padded(y + k, x + l);
+                    const double distance = (k - border) * (k - border) + (l - border) * (l - border);
+                    const double weight = std::exp(-distance / (2.0 * sigma_spatial * sigma_spatial)
+                                                   - (value - centre) * (value - centre) / (2.0 * sigma_radiometric * sigma_radiometric));
+                    weightedSum += weight * value;
+                    weightSum += weight;
+                }
+            dst(y, x) = (float)(weightedSum / weightSum);
+        }
+    return dst;
+}
+
+cv::Mat_<float> referenceFilter(const cv::Mat_<float> &src, dip2::NoiseReductionAlgorithm algorithm, int kSize, float sigma_spatial, float sigma_radiometric)
+{
+    switch (algorithm) {
+        case dip2::NR_MOVING_AVERAGE_FILTER: return referenceAverage(src, kSize);
+        case dip2::NR_MEDIAN_FILTER: return referenceMedian(src, kSize);
+        case dip2::NR_BILATERAL_FILTER: return referenceBilateral(src, kSize, sigma_spatial, sigma_radiometric);
+        default: throw std::runtime_error("Unhandled filter type!");
+    }
+}
+
+// Laplacian pyramid as described for dip2::pyramidFilter(...), with the reference filter on every band
+cv::Mat_<float> referencePyramid(const cv::Mat_<float> &src, dip2::NoiseReductionAlgorithm algorithm, int levels, int kSize)
+{
+    std::vector<cv::Mat_<float>> gaussian(1, src);
+    while ((int)gaussian.size() < levels && gaussian.back().rows / 2 >= kSize && gaussian.back().cols / 2 >= kSize) {
+        cv::Mat_<float> down;
+        cv::pyrDown(gaussian.back(), down);
+        gaussian.push_back(down);
+    }
+    cv::Mat_<float> result = referenceFilter(gaussian.back(), algorithm, kSize, 0.0f, 0.0f);
+    for (int l = (int)gaussian.size() - 2; l >= 0; l--) {
+        cv::Mat_<float> up;
+        cv::pyrUp(gaussian[l + 1], up, gaussian[l].size());
+        cv::Mat_<float> band = gaussian[l] - up;
+        cv::pyrUp(result, up, gaussian[l].size());
+        result = up + referenceFilter(band, algorithm, kSize, 0.0f, 0.0f);
+    }
+    return result;
+}
+
+// Float sums over a window of terms values of a normalized filter: every product and every partial sum is rounded
+// by at most maxValue * 2^-24. A k x k window takes k^2 terms directly and 2k separably.
+float summationBound(int terms)
+{
+    return (float)(2 * terms * maxValue * std::ldexp(1.0, -24));
+}
+
+// Rounding by a storage precision with a significand of p bits, for values of at most maxValue (see test_storagePrecision)
+float storageBound(int significandBits)
+{
+    return (float)std::ldexp(1.0, (int)std::floor(std::log2(maxValue)) - significandBits);
+}
+
+// The filter tabulates the radiometric weights (4096 entries up to 5 sigma) and uses the nearest entry. The difference
+// is off by at most half a step of 5 sigma / 4095, which changes a weight by at most that times the maximal slope
+// 1 / (sigma sqrt(e)) of the gaussian. Weighted with the spatial weights, these errors move the normalized sum by at
+// most maxValue times their ratio to the smallest radiometric weight, exp(-maxValue^2 / (2 sigma^2)) (maxValue < 5 sigma).
+float bilateralBound(int kSize, float sigma_radiometric)
+{
+    const double weightError = 0.5 * 5.0 / 4095.0 / std::sqrt(std::exp(1.0));
+    const double smallestWeight = std::exp(-maxValue * maxValue / (2.0 * sigma_radiometric * sigma_radiometric));
+    return (float)(maxValue * weightError / smallestWeight) + summationBound(kSize * kSize);
+}
+
+float filterBound(dip2::NoiseReductionAlgorithm algorithm, int kSize, float sigma_radiometric)
+{
+    switch (algorithm) {
+        case dip2::NR_MOVING_AVERAGE_FILTER: return summationBound(kSize * kSize);
+        case dip2::NR_MEDIAN_FILTER: return 0.0f; // returns one of the input values
+        case dip2::NR_BILATERAL_FILTER: return bilateralBound(kSize, sigma_radiometric);
+        default: throw std::runtime_error("Unhandled filter type!");
+    }
+}
+
+// baseline: one line "<case name> <MPixel/s>" per case
+std::map<std::string, double> readBaseline(const std::string &filename)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream file(filename.c_str());
+    std::string name;
+    double throughput;
+    while (file >> name >> throughput)
+        baseline[name] = throughput;
+    return baseline;
+}
+
+void writeBaseline(const std::string &filename, const std::map<std::string, double> &baseline)
+{
+    std::ofstream file(filename.c_str());
+    for (std::map<std::string, double>::const_iterator it = baseline.begin(); it != baseline.end(); ++it)
+        file << it->first << " " << std::fixed << std::setprecision(3) << it->second << std::endl;
+    if (!file)
+        throw std::runtime_error("Cannot write " + filename);
+}
+
+}
+
+
+int main(int argc, char** argv)
+{
+    const std::string mode = argc > 1 ? argv[1] : "check";
+    const std::string directory = argc > 2 ? argv[2] : "regression_data";
+    const double maxSlowdown = argc > 3 ? std::atof(argv[3]) : 10.0;
+    const int threads = argc > 4 ? std::atoi(argv[4]) : 1;
+    if (mode != "check" && mode != "baseline") {
+        cout << "usage: " << argv[0] << " [check|baseline] [directory] [max slowdown in %] [threads]" << endl;
+        return -1;
+    }
+    cv::setNumThreads(threads);
+
+    cv::Mat_<float> kernel(5, 5);
+    for (int k = 0; k < kernel.rows; k++)
+        for (int l = 0; l < kernel.cols; l++)
+            kernel(k, l) = (float)((k * 7 + l * 3) % 5 + 1) / 75.0f; // not separable
+
+    cv::Mat_<double> mirrored(kernel.size());
+    for (int k = 0; k < kernel.rows; k++)
+        for (int l = 0; l < kernel.cols; l++)
+            mirrored(k, l) = kernel(k, l);
+
+    // float16 storage adds a rounding per stored intermediate (see test_storagePrecision): two for the separable
+    // average, one per band plus three for the pyramid steps of every level for the pyramid
+    const int pyramidLevels = 3;
+    const float half = storageBound(11);
+    std::vector<RegressionCase> cases = {
+        {"spatialConvolution_5x5", dip2::NOISE_TYPE_2, summationBound(25),
+            [&](const cv::Mat_<float> &img) { return dip2::spatialConvolution(img, kernel); },
+            [&](const cv::Mat_<float> &img) { return referenceConvolution(img, mirrored); }},
+        {"averageFilter_3", dip2::NOISE_TYPE_2, filterBound(dip2::NR_MOVING_AVERAGE_FILTER, 3, 0.0f),
+            [](const cv::Mat_<float> &img) { return dip2::averageFilter(img, 3); },
+            [](const cv::Mat_<float> &img) { return referenceAverage(img, 3); }},
+        {"averageFilter_15", dip2::NOISE_TYPE_2, filterBound(dip2::NR_MOVING_AVERAGE_FILTER, 15, 0.0f),
+            [](const cv::Mat_<float> &img) { return dip2::averageFilter(img, 15); },
+            [](const cv::Mat_<float> &img) { return referenceAverage(img, 15); }},
+        {"medianFilter_3", dip2::NOISE_TYPE_1, filterBound(dip2::NR_MEDIAN_FILTER, 3, 0.0f),
+            [](const cv::Mat_<float> &img) { return dip2::medianFilter(img, 3); },
+            [](const cv::Mat_<float> &img) { return referenceMedian(img, 3); }},
+        {"medianFilter_7", dip2::NOISE_TYPE_1, filterBound(dip2::NR_MEDIAN_FILTER, 7, 0.0f),
+            [](const cv::Mat_<float> &img) { return dip2::medianFilter(img, 7); },
+            [](const cv::Mat_<float> &img) { return referenceMedian(img, 7); }},
+        {"medianFilter_15", dip2::NOISE_TYPE_1, filterBound(dip2::NR_MEDIAN_FILTER, 15, 0.0f),
+            [](const cv::Mat_<float> &img) { return dip2::medianFilter(img, 15); },
+            [](const cv::Mat_<float> &img) { return referenceMedian(img, 15); }},
+        {"bilateralFilter_9", dip2::NOISE_TYPE_2, filterBound(dip2::NR_BILATERAL_FILTER, 9, 200.0f),
+            [](const cv::Mat_<float> &img) { return dip2::bilateralFilter(img, 9, 3.0f, 200.0f); },
+            [](const cv::Mat_<float> &img) { return referenceBilateral(img, 9, 3.0f, 200.0f); }},
+        // same pyramid steps as the reference, and the median is exact
+        {"pyramidFilter_median_3", dip2::NOISE_TYPE_1, 0.0f,
+            [=](const cv::Mat_<float> &img) { return dip2::pyramidFilter(img, dip2::NR_MEDIAN_FILTER, pyramidLevels, 3, 0.0f, 0.0f); },
+            [=](const cv::Mat_<float> &img) { return referencePyramid(img, dip2::NR_MEDIAN_FILTER, pyramidLevels, 3); }},
+        {"averageFilter_15_float16", dip2::NOISE_TYPE_2, 2 * half + filterBound(dip2::NR_MOVING_AVERAGE_FILTER, 15, 0.0f),
+            [](const cv::Mat_<float> &img) {
+                dip2::FilterPlan plan(dip2::NR_MOVING_AVERAGE_FILTER, 15, 0.0f, 0.0f, img.size());
+                plan.setStorage(dip2::STORAGE_FLOAT16);
+                return plan.execute(img);
+            },
+            [](const cv::Mat_<float> &img) { return referenceAverage(img, 15); }},
+        {"pyramidFilter_median_3_float16", dip2::NOISE_TYPE_1, pyramidLevels * (1 + 3) * half,
+            [=](const cv::Mat_<float> &img) { return dip2::pyramidFilter(img, dip2::NR_MEDIAN_FILTER, pyramidLevels, 3, 0.0f, 0.0f, dip2::STORAGE_FLOAT16); },
+            [=](const cv::Mat_<float> &img) { return referencePyramid(img, dip2::NR_MEDIAN_FILTER, pyramidLevels, 3); }},
+    };
+    // the complete denoising for every noise type and algorithm, with the parameters of denoiseImage(...)
+    for (int i = 0; i < dip2::NUM_NOISE_TYPES; i++)
+        for (int j = 0; j < dip2::NUM_FILTERS; j++) {
+            const dip2::NoiseType noiseType = (dip2::NoiseType)i;
+            const dip2::NoiseReductionAlgorithm algorithm = (dip2::NoiseReductionAlgorithm)j;
+            const dip2::FilterParameters params = dip2::denoiseParameters(noiseType, algorithm);
+            RegressionCase c = {std::string("denoiseImage_") + dip2::noiseTypeNames[i] + "_" + dip2::noiseReductionAlgorithmNames[j], noiseType,
+                                filterBound(algorithm, params.kSize, params.sigma_radiometric),
+                                [noiseType, algorithm](const cv::Mat_<float> &img) { return dip2::denoiseImage(img, noiseType, algorithm); },
+                                [algorithm, params](const cv::Mat_<float> &img) {
+                                    return referenceFilter(img, algorithm, params.kSize, params.sigma_spatial, params.sigma_radiometric);
+                                }};
+            cases.push_back(c);
+        }
+
+#if defined(__unix__) || defined(__APPLE__)
+    if (mode == "baseline")
+        mkdir(directory.c_str(), 0755); // may already exist
+#endif
+    std::stringstream baselineName;
+    baselineName << directory << "/baseline_" << threads << "threads.txt";
+    const std::string baselineFile = baselineName.str();
+    std::map<std::string, double> baseline = readBaseline(baselineFile);
+
+    cv::Mat_<float> original = syntheticImage(imageSize, imageSize);
+    cv::Mat_<float> noisy[dip2::NUM_NOISE_TYPES];
+    for (int i = 0; i < dip2::NUM_NOISE_TYPES; i++)
+        noisy[i] = dip2::generateNoisyImage(original, (dip2::NoiseType)i, seed);
+
+    cout << "mode: " << mode << ", data: " << directory << ", threads: " << cv::getNumThreads()
+         << ", image: " << imageSize << "x" << imageSize << ", max slowdown: " << maxSlowdown << "%" << endl;
+    cout << endl;
+    size_t nameWidth = 0;
+    for (const RegressionCase &c : cases)
+        nameWidth = std::max(nameWidth, c.name.size() + 2);
+    cout << left << setw(nameWidth) << "case" << right << setw(12) << "ms" << setw(12) << "MPixel/s" << setw(12) << "baseline"
+         << setw(10) << "change" << setw(14) << "max diff" << setw(14) << "tolerance" << endl;
+
+    int failures = 0;
+    for (const RegressionCase &c : cases) {
+        const cv::Mat_<float> &input = noisy[c.noiseType];
+
+        // best of several runs, the first one also warms up the thread pool and allocator
+        cv::Mat_<float> result;
+        double seconds = 0.0;
+        try {
+            for (int r = 0; r < repetitions; r++) {
+                int64 start = cv::getTickCount();
+                result = c.run(input);
+                double elapsed = (cv::getTickCount() - start) / cv::getTickFrequency();
+                if (r == 0 || elapsed < seconds)
+                    seconds = elapsed;
+            }
+        } catch (const std::exception &e) {
+            // a failing case must not keep the others from running, and records nothing
+            cout << left << setw(nameWidth) << c.name << endl;
+            cout << "ERROR: " << c.name << ": " << e.what() << endl;
+            failures++;
+            continue;
+        }
+        const double throughput = input.total() / seconds * 1e-6;
+
+        cout << left << setw(nameWidth) << c.name << right << setw(12) << fixed << setprecision(2) << seconds * 1e3 << setw(12) << throughput;
+
+        if (mode == "baseline") {
+            baseline[c.name] = throughput;
+            cout << endl;
+            continue;
+        }
+
+        std::map<std::string, double>::const_iterator reference = baseline.find(c.name);
+        double change = 0.0;
+        if (reference != baseline.end()) {
+            change = (throughput / reference->second - 1.0) * 100.0;
+            cout << setw(12) << reference->second << setw(9) << setprecision(1) << showpos << change << "%" << noshowpos;
+        } else
+            cout << setw(12) << "n/a" << setw(10) << "n/a";
+
+        const double maxDiff = cv::norm(result, c.reference(input), cv::NORM_INF);
+        cout << setw(14) << setprecision(6) << maxDiff << setw(14) << c.tolerance << endl;
+        if (!(maxDiff <= c.tolerance)) {
+            cout << "ERROR: " << c.name << ": output deviates from the reference by " << maxDiff << " (tolerance " << c.tolerance << ")" << endl;
+            failures++;
+        }
+
+        if (reference == baseline.end())
+            cout << "WARNING: " << c.name << ": no baseline throughput in " << baselineFile << " (record it with \"baseline\")" << endl;
+        else if (change < -maxSlowdown) {
+            cout << "ERROR: " << c.name << ": throughput dropped by " << -change << "% (allowed " << maxSlowdown << "%)" << endl;
+            failures++;
+        }
+    }
+
+    cout << endl;
+    if (mode == "baseline") {
+        writeBaseline(baselineFile, baseline);
+        cout << "Message: baseline written to " << directory << endl;
+        if (failures > 0) {
+            cout << "ERROR: " << failures << " case(s) failed and were not recorded" << endl;
+            return -1;
+        }
+        return 0;
+    }
+    if (failures > 0) {
+        cout << "ERROR: " << failures << " regression(s) found" << endl;
+        return -1;
+    }
+    if (baseline.empty())
+        cout << "Message: all outputs match their references, no baseline throughput to compare with" << endl;
+    else
+        cout << "Message: all outputs match their references and no throughput regressions were found relative to " << baselineFile << endl;
+    return 0;
+}
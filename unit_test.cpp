@@ -8,9 +8,14 @@
 
 
 #include "Dip2.h"
+#include "TemporalFilter.h"
+#include "RegionFilter.h"
+#include "NoiseGenerator.h"
+#include "AsyncDenoiser.h"
 
 #include <opencv2/opencv.hpp>
 
+#include <algorithm>
 #include <iostream>
 
 #include <random>
@@ -294,6 +299,617 @@ void test_bilateralFilter()
 }
 
 
+// checks that filter plans give the same results as the one-shot filters and can be reused
+void test_filterPlan()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist(0.0f, 255.0f);
+
+    cv::Mat_<float> frames[3];
+    for (unsigned i = 0; i < 3; i++) {
+        frames[i].create(37, 53);
+        for (unsigned y = 0; y < frames[i].rows; y++)
+            for (unsigned x = 0; x < frames[i].cols; x++)
+                frames[i](y, x) = dist(rng);
+    }
+
+    {
+        cv::Mat_<float> kernel(3, 5);
+        for (unsigned y = 0; y < kernel.rows; y++)
+            for (unsigned x = 0; x < kernel.cols; x++)
+                kernel(y, x) = dist(rng) / 255.0f;
+        cv::Mat_<float> original = kernel.clone();
+
+        FilterPlan plan(kernel, frames[0].size());
+        if (plan.backend() != BACKEND_DIRECT) {
+            cout << "ERROR: Dip2::FilterPlan: non-separable kernel got backend " << filterBackendNames[plan.backend()] << endl;
+            exit(-1);
+        }
+        cv::Mat_<float> output;
+        for (unsigned i = 0; i < 3; i++) {
+            plan.execute(frames[i], output);
+            if (cv::norm(output, spatialConvolution(frames[i], kernel), cv::NORM_INF) > 1e-3) {
+                cout << "ERROR: Dip2::FilterPlan: reused convolution plan gives a different result than Dip2::spatialConvolution()" << endl;
+                exit(-1);
+            }
+        }
+        if (cv::norm(kernel, original, cv::NORM_INF) != 0.0) {
+            cout << "ERROR: Dip2::FilterPlan / Dip2::spatialConvolution(): the caller's kernel got modified" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        FilterPlan plan(NR_MOVING_AVERAGE_FILTER, 5, 0.0f, 0.0f, frames[0].size());
+        if (plan.backend() != BACKEND_SEPARABLE) {
+            cout << "ERROR: Dip2::FilterPlan: box filter should use " << filterBackendNames[BACKEND_SEPARABLE] << endl;
+            exit(-1);
+        }
+        cv::Mat_<float> kernel(5, 5, 1.0f / 25.0f);
+        kernel(0, 0) += 1e-3f; // no longer separable
+        cv::Mat_<float> reference = FilterPlan(cv::Mat_<float>(5, 5, 1.0f / 25.0f), frames[0].size()).execute(frames[1]);
+        if (cv::norm(plan.execute(frames[1]), reference, cv::NORM_INF) > 1e-3) {
+            cout << "ERROR: Dip2::FilterPlan: separable backend gives a different result" << endl;
+            exit(-1);
+        }
+        if (FilterPlan(kernel, frames[0].size()).backend() != BACKEND_DIRECT) {
+            cout << "ERROR: Dip2::FilterPlan: non-separable kernel detected as separable" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        // in place execution
+        FilterPlan plan(NR_MEDIAN_FILTER, 3, 0.0f, 0.0f, frames[2].size());
+        cv::Mat_<float> reference = medianFilter(frames[2], 3);
+        cv::Mat_<float> image = frames[2].clone();
+        plan.execute(image, image);
+        if (cv::norm(image, reference, cv::NORM_INF) != 0.0) {
+            cout << "ERROR: Dip2::FilterPlan: in place execution gives a different result" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        FilterPlan plan(NR_BILATERAL_FILTER, 5, 2.0f, 30.0f, cv::Size(10, 10));
+        bool thrown = false;
+        try {
+            plan.execute(frames[0]);
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        if (!thrown) {
+            cout << "ERROR: Dip2::FilterPlan: executing on an image of wrong size is not detected" << endl;
+            exit(-1);
+        }
+    }
+   cout << "Message: Dip2::FilterPlan seems to be correct" << endl;
+}
+
+// checks that the sliding window median gives exactly the same result as sorting each window
+void test_medianBackends()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist(0.0f, 255.0f);
+
+    // continuous values and values with many ties
+    cv::Mat_<float> images[2];
+    for (unsigned i = 0; i < 2; i++) {
+        images[i].create(41, 67);
+        for (unsigned y = 0; y < images[i].rows; y++)
+            for (unsigned x = 0; x < images[i].cols; x++)
+                images[i](y, x) = i == 0 ? dist(rng) : std::floor(dist(rng) / 32.0f);
+    }
+
+    for (int kSize = 1; kSize <= 11; kSize += 2) {
+        FilterPlan direct(NR_MEDIAN_FILTER, kSize, 0.0f, 0.0f, images[0].size());
+        FilterPlan sliding(NR_MEDIAN_FILTER, kSize, 0.0f, 0.0f, images[0].size());
+        direct.setBackend(BACKEND_DIRECT);
+        sliding.setBackend(BACKEND_SLIDING_WINDOW);
+        for (unsigned i = 0; i < 2; i++) {
+            if (cv::norm(direct.execute(images[i]), sliding.execute(images[i]), cv::NORM_INF) != 0.0) {
+                cout << "ERROR: Dip2::FilterPlan: " << filterBackendNames[BACKEND_SLIDING_WINDOW] << " median differs from "
+                     << filterBackendNames[BACKEND_DIRECT] << " for kSize " << kSize << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    if (FilterPlan(NR_MEDIAN_FILTER, 9, 0.0f, 0.0f, images[0].size()).backend() != BACKEND_SLIDING_WINDOW) {
+        cout << "ERROR: Dip2::FilterPlan: large median windows should use " << filterBackendNames[BACKEND_SLIDING_WINDOW] << endl;
+        exit(-1);
+    }
+
+    bool thrown = false;
+    try {
+        FilterPlan(NR_BILATERAL_FILTER, 5, 2.0f, 30.0f, images[0].size()).setBackend(BACKEND_SLIDING_WINDOW);
+    } catch (const std::runtime_error &) {
+        thrown = true;
+    }
+    if (!thrown) {
+        cout << "ERROR: Dip2::FilterPlan::setBackend(): unsupported backend was accepted" << endl;
+        exit(-1);
+    }
+
+    cout << "Message: Dip2::FilterPlan median backends seem to be correct" << endl;
+}
+
+// checks that 16 bit scratch buffers only cause rounding errors of the stored precision
+void test_storagePrecision()
+{
+    std::mt19937 rng;
+    std::uniform_int_distribution<int> dist(0, 255);
+
+    // integer grey values are exactly representable in half precision
+    cv::Mat_<float> image(45, 77);
+    for (unsigned y = 0; y < image.rows; y++)
+        for (unsigned x = 0; x < image.cols; x++)
+            image(y, x) = (float)dist(rng);
+    cv::Mat_<float> noisy = image.clone();
+    for (unsigned y = 0; y < noisy.rows; y++)
+        for (unsigned x = 0; x < noisy.cols; x++)
+            noisy(y, x) += 0.37f;
+
+    for (int kSize = 3; kSize <= 9; kSize += 6) {
+        FilterPlan median(NR_MEDIAN_FILTER, kSize, 0.0f, 0.0f, image.size());
+        median.setStorage(STORAGE_FLOAT16);
+        if (cv::norm(median.execute(image), medianFilter(image, kSize), cv::NORM_INF) != 0.0) {
+            cout << "ERROR: Dip2::FilterPlan: " << storagePrecisionNames[STORAGE_FLOAT16] << " median differs for integer grey values" << endl;
+            exit(-1);
+        }
+    }
+
+    // Storing a value v rounds it by at most half the spacing of the representable values around v. All stored
+    // values are at most maxValue, so with a significand of p bits the rounding error is below 2^(floor(log2(maxValue)) - p).
+    // Summing a window of kSize values in float adds at most kSize * maxValue * 2^-24 per filter pass.
+    const int kSize = 5;
+    const double maxValue = cv::norm(noisy, cv::NORM_INF);
+    const int significandBits[NUM_STORAGE_PRECISIONS] = {24, 11, 8};
+    float rounding[NUM_STORAGE_PRECISIONS];
+    for (int storage = 0; storage < NUM_STORAGE_PRECISIONS; storage++)
+        rounding[storage] = (float)std::ldexp(1.0, (int)std::floor(std::log2(maxValue)) - significandBits[storage]);
+    const float summation = (float)(2 * kSize * maxValue * std::ldexp(1.0, -24));
+
+    // Number of roundings reaching the output. The median returns one of the rounded input values. The separable
+    // average has unit gain in both passes, so the rounding of the padded input and of the intermediate row results
+    // (which stay within the value range of the image) both reach the output unattenuated. The bilateral weights
+    // depend on the stored values themselves, its factor is empirical.
+    const NoiseReductionAlgorithm algorithms[] = {NR_MOVING_AVERAGE_FILTER, NR_MEDIAN_FILTER, NR_BILATERAL_FILTER};
+    const float roundings[] = {2.0f, 1.0f, 4.0f};
+    for (unsigned a = 0; a < 3; a++) {
+        FilterPlan plan(algorithms[a], kSize, 2.0f, 50.0f, image.size());
+        cv::Mat_<float> reference = plan.execute(noisy);
+        for (int storage = STORAGE_FLOAT16; storage < NUM_STORAGE_PRECISIONS; storage++) {
+            plan.setStorage((StoragePrecision)storage);
+            const float bound = roundings[a] * rounding[storage] + summation;
+            if (cv::norm(plan.execute(noisy), reference, cv::NORM_INF) > bound) {
+                cout << "ERROR: Dip2::FilterPlan: " << noiseReductionAlgorithmNames[algorithms[a]] << " with " << storagePrecisionNames[storage]
+                     << " storage deviates too much from " << storagePrecisionNames[STORAGE_FLOAT32] << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    // the same bounds hold for applyFilter(...), and per level for the pyramid with 16 bit levels and bands
+    for (int storage = STORAGE_FLOAT16; storage < NUM_STORAGE_PRECISIONS; storage++) {
+        for (unsigned a = 0; a < 2; a++) {
+            cv::Mat_<float> reference = applyFilter(noisy, algorithms[a], kSize, 2.0f, 50.0f);
+            if (cv::norm(applyFilter(noisy, algorithms[a], kSize, 2.0f, 50.0f, (StoragePrecision)storage), reference, cv::NORM_INF) > roundings[a] * rounding[storage] + summation) {
+                cout << "ERROR: Dip2::applyFilter(): " << noiseReductionAlgorithmNames[algorithms[a]] << " with " << storagePrecisionNames[storage]
+                     << " storage deviates too much from " << storagePrecisionNames[STORAGE_FLOAT32] << endl;
+                exit(-1);
+            }
+            const int levels = 3;
+            reference = pyramidFilter(noisy, algorithms[a], levels, 3, 2.0f, 50.0f);
+            // The Gaussian levels and the bands stay within [-maxValue, maxValue] and pyrUp has unit gain. Per level the
+            // filter sees its band rounded up to twice (stored Gaussian level and the upsampled coarser one), then adds the
+            // rounding of its own scratch buffers and of the stored result band.
+            if (cv::norm(pyramidFilter(noisy, algorithms[a], levels, 3, 2.0f, 50.0f, (StoragePrecision)storage), reference, cv::NORM_INF)
+                    > levels * ((roundings[a] + 3.0f) * rounding[storage] + summation)) {
+                cout << "ERROR: Dip2::pyramidFilter(): " << noiseReductionAlgorithmNames[algorithms[a]] << " with " << storagePrecisionNames[storage]
+                     << " storage deviates too much from " << storagePrecisionNames[STORAGE_FLOAT32] << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    cout << "Message: Dip2::FilterPlan storage precisions seem to be correct" << endl;
+}
+
+// checks basic properties of the multi-scale filtering result
+void test_pyramidFilter()
+{
+    {
+        cv::Mat_<float> input = cv::Mat_<float>::ones(64, 48) * 100.0f;
+        for (unsigned j = 0; j < dip2::NUM_FILTERS; j++) {
+            cv::Mat_<float> output = pyramidFilter(input, (dip2::NoiseReductionAlgorithm) j, 4, 3, 1.0f, 1000.0f);
+            if ( (input.cols != output.cols) || (input.rows != output.rows) ){
+                cout << "ERROR: Dip2::pyramidFilter(): input.size != output.size --> Wrong pyramid reconstruction?" << endl;
+                exit(-1);
+            }
+            if (cv::norm(output, input, cv::NORM_INF) > 1e-2) {
+                cout << "ERROR: Dip2::pyramidFilter(): completely homogeneous image gets changed with " << noiseReductionAlgorithmNames[j] << endl;
+                cout << "    Are the Laplacian bands collapsed correctly?" << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    {
+        std::mt19937 rng;
+        std::normal_distribution<float> dist(127.0f, 1.0f);
+
+        cv::Mat_<float> input(65, 65);
+        for (unsigned y = 0; y < input.rows; y++)
+            for (unsigned x = 0; x < input.cols; x++)
+                input(y, x) = dist(rng);
+
+        cv::Mat_<float> output = pyramidFilter(input, dip2::NR_MEDIAN_FILTER, 1, 3, 1.0f, 1.0f);
+        if (cv::norm(output, medianFilter(input, 3), cv::NORM_INF) > 1e-5) {
+            cout << "ERROR: Dip2::pyramidFilter(): a single level pyramid should be identical to the plain filter" << endl;
+            exit(-1);
+        }
+    }
+   cout << "Message: Dip2::pyramidFilter() seems to be correct" << endl;
+}
+
+// checks basic properties of the temporal filtering result
+void test_temporalFilter()
+{
+    {
+        // window average and median over a static scene with a single outlier frame
+        for (unsigned m = TEMPORAL_WINDOW_AVERAGE; m <= TEMPORAL_WINDOW_MEDIAN; m++) {
+            TemporalFilter filter((TemporalMode) m, 5, 0.0f);
+            float values[7] = {10.0f, 20.0f, 30.0f, 255.0f, 40.0f, 50.0f, 60.0f};
+            cv::Mat_<float> output;
+            for (unsigned i = 0; i < 7; i++)
+                output = filter.process(cv::Mat_<float>(8, 8, values[i]));
+
+            // window now holds the last 5 frames {30, 255, 40, 50, 60}
+            float expected = (m == TEMPORAL_WINDOW_AVERAGE) ? (30.0f + 255.0f + 40.0f + 50.0f + 60.0f) / 5.0f : 50.0f;
+            if ( (output.rows != 8) || (output.cols != 8) || (std::abs(output(3, 4) - expected) > 1e-3f) ){
+                cout << "ERROR: Dip2::TemporalFilter(" << temporalModeNames[m] << "): wrong result after sliding the window" << endl;
+                cout << "    got " << output(3, 4) << ", expected " << expected << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    {
+        // noise on a static scene has to be reduced
+        std::mt19937 rng;
+        std::normal_distribution<float> dist(0.0f, 10.0f);
+        cv::Mat_<float> scene(32, 32, 100.0f);
+
+        for (unsigned m = 0; m < NUM_TEMPORAL_MODES; m++) {
+            TemporalFilter filter((TemporalMode) m, 8, 1000.0f);
+            cv::Mat_<float> noisy, output;
+            for (unsigned i = 0; i < 16; i++) {
+                noisy = scene.clone();
+                for (unsigned y = 0; y < noisy.rows; y++)
+                    for (unsigned x = 0; x < noisy.cols; x++)
+                        noisy(y, x) += dist(rng);
+                output = filter.process(noisy);
+            }
+            if (cv::norm(output, scene) > 0.6 * cv::norm(noisy, scene)) {
+                cout << "ERROR: Dip2::TemporalFilter(" << temporalModeNames[m] << "): noise on a static scene is not reduced" << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    {
+        // motion gating has to let sudden changes through
+        TemporalFilter filter(TEMPORAL_RECURSIVE_AVERAGE, 8, 20.0f);
+        for (unsigned i = 0; i < 8; i++)
+            filter.process(cv::Mat_<float>(8, 8, 0.0f));
+        cv::Mat_<float> output = filter.process(cv::Mat_<float>(8, 8, 200.0f));
+        if (std::abs(output(4, 4) - 200.0f) > 1e-3f) {
+            cout << "ERROR: Dip2::TemporalFilter(): moving pixels are not taken from the current frame (ghosting)" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        // the spatial fallback only replaces moving pixels, by the result of filtering the whole frame
+        std::mt19937 rng;
+        std::uniform_real_distribution<float> dist(0.0f, 10.0f);
+        TemporalFilter spatioTemporal(TEMPORAL_RECURSIVE_AVERAGE, 8, 20.0f);
+        TemporalFilter temporal(TEMPORAL_RECURSIVE_AVERAGE, 8, 20.0f);
+        cv::Mat_<float> frame(150, 170);
+        for (unsigned i = 0; i < 9; i++) {
+            for (int y = 0; y < frame.rows; y++)
+                for (int x = 0; x < frame.cols; x++)
+                    frame(y, x) = dist(rng);
+            if (i == 8) {
+                // an object appears, spanning several motion blocks
+                for (int y = 55; y < 80; y++)
+                    for (int x = 50; x < 140; x++)
+                        frame(y, x) += 200.0f;
+            }
+            cv::Mat_<float> output = spatioTemporal.process(frame, NOISE_TYPE_1, NR_BILATERAL_FILTER);
+            cv::Mat_<float> reference = temporal.process(frame);
+            if (i < 8)
+                continue;
+
+            cv::Mat_<float> spatial = denoiseImage(frame, NOISE_TYPE_1, NR_BILATERAL_FILTER);
+            for (int y = 0; y < frame.rows; y++)
+                for (int x = 0; x < frame.cols; x++) {
+                    const bool moving = y >= 55 && y < 80 && x >= 50 && x < 140;
+                    const float expected = moving ? spatial(y, x) : reference(y, x);
+                    if (std::abs(output(y, x) - expected) > 1e-3f) {
+                        cout << "ERROR: Dip2::TemporalFilter(): wrong spatial fallback at (" << y << ", " << x << ")" << endl;
+                        exit(-1);
+                    }
+                }
+        }
+    }
+   cout << "Message: Dip2::TemporalFilter seems to be correct" << endl;
+}
+
+// checks that region filtering matches filtering the whole image
+void test_regionFilter()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist(0.0f, 255.0f);
+
+    cv::Mat_<float> input(40, 50);
+    for (unsigned y = 0; y < input.rows; y++)
+        for (unsigned x = 0; x < input.cols; x++)
+            input(y, x) = dist(rng);
+
+    {
+        cv::Rect roi(0, 10, 17, 25); // touches the left image border
+        for (unsigned j = 0; j < dip2::NUM_FILTERS; j++) {
+            cv::Mat_<float> reference = applyFilter(input, (dip2::NoiseReductionAlgorithm) j, 5, 2.0f, 50.0f);
+            cv::Mat_<float> output(input.rows, input.cols, -1.0f);
+            filterRegion(input, output, roi, (dip2::NoiseReductionAlgorithm) j, 5, 2.0f, 50.0f);
+
+            if (cv::norm(output(roi), reference(roi), cv::NORM_INF) > 1e-3) {
+                cout << "ERROR: Dip2::filterRegion(): result inside the region differs from filtering the whole image with "
+                     << noiseReductionAlgorithmNames[j] << " --> Wrong halo?" << endl;
+                exit(-1);
+            }
+            if ( (output(5, 5) != -1.0f) || (output(20, 30) != -1.0f) ) {
+                cout << "ERROR: Dip2::filterRegion(): pixels outside of the region got changed" << endl;
+                exit(-1);
+            }
+        }
+    }
+
+    {
+        RegionFilter filter(dip2::NR_MEDIAN_FILTER, 3, 1.0f, 1.0f);
+        cv::Mat_<float> image = input.clone();
+        filter.update(image);
+
+        // edit two small regions, one of them at the image corner
+        cv::Rect edits[2] = {cv::Rect(10, 10, 4, 3), cv::Rect(45, 36, 5, 4)};
+        for (unsigned i = 0; i < 2; i++) {
+            image(edits[i]).setTo(0.0f);
+            filter.markDirty(edits[i]);
+        }
+        cv::Mat_<float> output = filter.update(image);
+
+        if (cv::norm(output, medianFilter(image, 3), cv::NORM_INF) > 1e-3) {
+            cout << "ERROR: Dip2::RegionFilter: incremental update differs from filtering the whole image" << endl;
+            exit(-1);
+        }
+        if (!filter.dirtyRegions().empty()) {
+            cout << "ERROR: Dip2::RegionFilter: dirty regions not cleared by update" << endl;
+            exit(-1);
+        }
+    }
+   cout << "Message: Dip2::filterRegion() and Dip2::RegionFilter seem to be correct" << endl;
+}
+
+// checks that the cache tiled traversal gives the same result on images spanning many tiles
+void test_tiledFilters()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist(0.0f, 255.0f);
+
+    cv::Size tile = filterTileSize(5, 5);
+    cv::Mat_<float> input(2 * tile.height + 7, 3 * tile.width + 5);
+    for (unsigned y = 0; y < input.rows; y++)
+        for (unsigned x = 0; x < input.cols; x++)
+            input(y, x) = dist(rng);
+
+    cv::Mat_<float> kernel(5, 5);
+    for (unsigned y = 0; y < 5; y++)
+        for (unsigned x = 0; x < 5; x++)
+            kernel(y, x) = dist(rng) / 255.0f / 25.0f;
+    cv::Mat_<float> flipped;
+    cv::flip(kernel, flipped, -1);
+
+    cv::Mat_<float> output = spatialConvolution(input, kernel.clone());
+    cv::Mat_<float> median = medianFilter(input, 5);
+
+    // naive reference with replicated border
+    for (int y = 0; y < input.rows; y++)
+        for (int x = 0; x < input.cols; x++) {
+            float sum = 0.0f;
+            std::vector<float> values;
+            for (int k = 0; k < 5; k++)
+                for (int l = 0; l < 5; l++) {
+                    float v = input(std::min(std::max(y + k - 2, 0), input.rows - 1), std::min(std::max(x + l - 2, 0), input.cols - 1));
+                    sum += flipped(k, l) * v;
+                    values.push_back(v);
+                }
+            std::sort(values.begin(), values.end());
+            if (std::abs(output(y, x) - sum) > 1e-2f) {
+                cout << "ERROR: Dip2::spatialConvolution(): wrong result at (" << y << ", " << x << ") --> Wrong tile or halo handling?" << endl;
+                exit(-1);
+            }
+            if (median(y, x) != values[12]) {
+                cout << "ERROR: Dip2::medianFilter(): wrong result at (" << y << ", " << x << ") --> Wrong tile or halo handling?" << endl;
+                exit(-1);
+            }
+        }
+   cout << "Message: tiled Dip2::spatialConvolution() and Dip2::medianFilter() seem to be correct" << endl;
+}
+
+// checks determinism and statistics of the synthetic noise
+void test_noiseGenerator()
+{
+    cv::Mat_<float> input(300, 200, 127.0f);
+
+    {
+        // same seed has to give the same noise, independent of the number of threads
+        NoiseParameters params = {0.05f, 10.0f, 2.0f, 0.1f};
+        cv::Mat_<float> parallel = input.clone();
+        addNoise(parallel, params, 1234);
+
+        int threads = cv::getNumThreads();
+        cv::setNumThreads(1);
+        cv::Mat_<float> sequential = input.clone();
+        addNoise(sequential, params, 1234);
+        cv::setNumThreads(threads);
+
+        if (cv::norm(parallel, sequential, cv::NORM_INF) != 0.0) {
+            cout << "ERROR: Dip2::addNoise(): result depends on the number of threads" << endl;
+            exit(-1);
+        }
+        cv::Mat_<float> other = input.clone();
+        addNoise(other, params, 1235);
+        if (cv::norm(parallel, other, cv::NORM_INF) == 0.0) {
+            cout << "ERROR: Dip2::addNoise(): different seeds give the same noise" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        cv::Mat_<float> noisy = generateNoisyImage(input, dip2::NOISE_TYPE_1, 0);
+        double black = cv::countNonZero(noisy == 0.0f) / (double) noisy.total();
+        double white = cv::countNonZero(noisy == 255.0f) / (double) noisy.total();
+        if ( (std::abs(black - 0.15) > 0.01) || (std::abs(white - 0.15) > 0.01) ) {
+            cout << "ERROR: Dip2::generateNoisyImage(): NOISE_TYPE_1 has wrong impulse probabilities " << black << " / " << white << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        NoiseParameters params = {0.0f, 10.0f, 0.0f, 0.0f};
+        cv::Mat_<float> noisy = input.clone();
+        addNoise(noisy, params, 0);
+        cv::Mat_<float> diff = noisy - input;
+        double mean = cv::mean(diff)[0];
+        double sigma = std::sqrt(cv::mean(diff.mul(diff))[0] - mean * mean);
+        if ( (std::abs(mean) > 0.2) || (std::abs(sigma - 10.0) > 0.2) ) {
+            cout << "ERROR: Dip2::addNoise(): gaussian noise has mean " << mean << " and sigma " << sigma << ", expected 0 and 10" << endl;
+            exit(-1);
+        }
+        // shape of the distribution: 4.55% of the values lie more than 2 sigma and 0.27% more than 3 sigma from the mean
+        cv::Mat_<float> absDiff;
+        cv::absdiff(noisy, input, absDiff);
+        double outside2 = cv::countNonZero(absDiff > 20.0f) / (double) absDiff.total();
+        double outside3 = cv::countNonZero(absDiff > 30.0f) / (double) absDiff.total();
+        if ( (std::abs(outside2 - 0.0455) > 0.004) || (std::abs(outside3 - 0.0027) > 0.001) ) {
+            cout << "ERROR: Dip2::addNoise(): gaussian noise has " << outside2 << " / " << outside3 << " of the values outside 2 / 3 sigma, expected 0.0455 / 0.0027" << endl;
+            exit(-1);
+        }
+        // horizontal neighbours share the uniform random numbers of Box-Muller, but must not be correlated
+        double correlation = cv::mean(diff.colRange(0, diff.cols - 1).mul(diff.colRange(1, diff.cols)))[0] / (sigma * sigma);
+        if (std::abs(correlation) > 0.02) {
+            cout << "ERROR: Dip2::addNoise(): gaussian noise of neighbouring pixels is correlated (" << correlation << ")" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        // shot noise: 4 photons per grey value on a grey value of 5 counts Poisson(20) photons, mean 5 and variance 20/16
+        NoiseParameters params = {0.0f, 0.0f, 4.0f, 0.0f};
+        cv::Mat_<float> flat(300, 200, 5.0f);
+        cv::Mat_<float> noisy = flat.clone();
+        addNoise(noisy, params, 0);
+        double mean = cv::mean(noisy)[0];
+        double variance = cv::mean(noisy.mul(noisy))[0] - mean * mean;
+        if ( (std::abs(mean - 5.0) > 0.02) || (std::abs(variance - 1.25) > 0.05) ) {
+            cout << "ERROR: Dip2::addNoise(): shot noise has mean " << mean << " and variance " << variance << ", expected 5 and 1.25" << endl;
+            exit(-1);
+        }
+    }
+   cout << "Message: Dip2::addNoise() seems to be correct" << endl;
+}
+
+// checks that asynchronously denoised images match the synchronous results
+void test_asyncDenoiser()
+{
+    std::mt19937 rng;
+    std::uniform_real_distribution<float> dist(0.0f, 255.0f);
+
+    // the larger images are split into row strips
+    const unsigned numImages = 12;
+    std::vector<cv::Mat_<float>> images(numImages);
+    for (unsigned i = 0; i < numImages; i++) {
+        images[i].create(20 + 37 * i, 30);
+        for (int y = 0; y < images[i].rows; y++)
+            for (int x = 0; x < images[i].cols; x++)
+                images[i](y, x) = dist(rng);
+    }
+
+    std::vector<cv::Mat_<float>> callbackResults(numImages);
+    {
+        // small queue, so submit has to block now and then
+        AsyncDenoiser denoiser(3, 2, 4000);
+        std::vector<std::future<cv::Mat_<float>>> futures;
+        for (unsigned i = 0; i < numImages; i++) {
+            futures.push_back(denoiser.submit(images[i], (NoiseType) (i % 2), (NoiseReductionAlgorithm) (i % 3), i % 4));
+            // every job writes to its own slot only
+            denoiser.submit(images[i], (NoiseType) (i % 2), (NoiseReductionAlgorithm) (i % 3), 0,
+                            [&callbackResults, i](const cv::Mat_<float> &result, std::exception_ptr) { callbackResults[i] = result; });
+        }
+
+        for (unsigned i = 0; i < numImages; i++) {
+            cv::Mat_<float> reference = denoiseImage(images[i], (NoiseType) (i % 2), (NoiseReductionAlgorithm) (i % 3));
+            if (cv::norm(futures[i].get(), reference, cv::NORM_INF) != 0.0) {
+                cout << "ERROR: Dip2::AsyncDenoiser: result of job " << i << " differs from Dip2::denoiseImage()" << endl;
+                exit(-1);
+            }
+        }
+        denoiser.waitIdle();
+        if ( (denoiser.queuedJobs() != 0) || (denoiser.queuedPixels() != 0) ) {
+            cout << "ERROR: Dip2::AsyncDenoiser: queue not empty after waitIdle()" << endl;
+            exit(-1);
+        }
+    }
+    for (unsigned i = 0; i < numImages; i++) {
+        cv::Mat_<float> reference = denoiseImage(images[i], (NoiseType) (i % 2), (NoiseReductionAlgorithm) (i % 3));
+        if (callbackResults[i].empty() || (cv::norm(callbackResults[i], reference, cv::NORM_INF) != 0.0)) {
+            cout << "ERROR: Dip2::AsyncDenoiser: callback of job " << i << " got a wrong result" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        // errors of denoiseImage have to reach the caller, once even if all strips of the image fail
+        AsyncDenoiser denoiser(3, 4, 1 << 20);
+        std::future<cv::Mat_<float>> result = denoiser.submit(images[numImages - 1], NUM_NOISE_TYPES, NR_MEDIAN_FILTER, 0);
+        bool thrown = false;
+        try {
+            result.get();
+        } catch (const std::runtime_error &) {
+            thrown = true;
+        }
+        if (!thrown) {
+            cout << "ERROR: Dip2::AsyncDenoiser: exception of Dip2::denoiseImage() got lost" << endl;
+            exit(-1);
+        }
+    }
+
+    {
+        // a throwing callback must neither terminate the process nor stop the worker
+        AsyncDenoiser denoiser(1, 4, 1 << 20);
+        denoiser.submit(images[0], NOISE_TYPE_1, NR_MEDIAN_FILTER, 0,
+                        [](const cv::Mat_<float> &, std::exception_ptr) { throw std::runtime_error("callback failed"); });
+        std::future<cv::Mat_<float>> result = denoiser.submit(images[1], NOISE_TYPE_1, NR_MEDIAN_FILTER, 0);
+        if (cv::norm(result.get(), denoiseImage(images[1], NOISE_TYPE_1, NR_MEDIAN_FILTER), cv::NORM_INF) != 0.0) {
+            cout << "ERROR: Dip2::AsyncDenoiser: worker broken after a throwing callback" << endl;
+            exit(-1);
+        }
+    }
+   cout << "Message: Dip2::AsyncDenoiser seems to be correct" << endl;
+}
+
 void test_denoiseImage()
 {
     cv::Mat img = cv::imdecode(cv::_InputArray((const char *)data_inputImage, data_inputImage_size), 0);
@@ -330,6 +946,15 @@ int main(int argc, char** argv) {
     test_averageFilter();
     test_medianFilter();
     test_bilateralFilter();
+    test_tiledFilters();
+    test_filterPlan();
+    test_medianBackends();
+    test_storagePrecision();
+    test_pyramidFilter();
+    test_temporalFilter();
+    test_regionFilter();
+    test_noiseGenerator();
+    test_asyncDenoiser();
     test_denoiseImage();
 
 	return 0;